@@ -6,20 +6,59 @@
 class NextionInterface;
 
 class CanInterface{
+private:
+    struct receiveHandler {
+        uint32_t id;
+        _MB_ptr handler;
+    };
+
+    static const receiveHandler receive_handlers[];
+
 public:
     CanInterface();
 
+    // what we send. these are placeholders until the powertrain DBC assigns them, nothing goes
+    // out with them unless the build defines CAN_TX_IDS_CONFIRMED (see platformio.ini)
+    constexpr static const uint32_t SHIFT_ID = 0x6F0;
+    constexpr static const uint32_t BUTTONS_ID = 0x6F1;
+    constexpr static const uint32_t HEARTBEAT_ID = 0x6F2;
+#ifdef CAN_TX_IDS_CONFIRMED
+    constexpr static const bool TX_IDS_CONFIRMED = true;
+#else
+    constexpr static const bool TX_IDS_CONFIRMED = false;
+#endif
+
     static bool canActive;
+    static volatile uint32_t lastFrameMillis;
+    static volatile uint32_t framesReceived;
+    static volatile uint8_t warningMask; // bit i set while byte i of the warning flags frame is nonzero
     static CAN_message_t shift_msg;
 
     static FlexCAN_T4<CAN2, RX_SIZE_256, TX_SIZE_16> Can0;
 
     static bool init();
 
+    static void restart();
+
+    // the IDs in receive_handlers, for per-ID stats through Can0.idFrameCount()
+    static uint8_t receiveIdCount();
+    static uint32_t receiveId(uint8_t index);
+
     static void print_can_sniff(const CAN_message_t &msg);
 
     static void receive_can_updates(const CAN_message_t &msg);
 
+    static void receive_rpm(const CAN_message_t &msg);
+    static void receive_temps(const CAN_message_t &msg);
+    static void receive_warnings(const CAN_message_t &msg);
+    static void receive_gear(const CAN_message_t &msg);
+    static void receive_pumps(const CAN_message_t &msg);
+    static void receive_oil_pressure(const CAN_message_t &msg);
+    static void receive_lambda(const CAN_message_t &msg);
+    static void receive_warning_flags(const CAN_message_t &msg);
+
+    static void packShift(CAN_message_t &msg, const bool up, const bool down, const bool button3);
+
     static void send_shift(const bool up, const bool down,const bool button3);
 
     static void task();
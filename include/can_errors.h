@@ -0,0 +1,84 @@
+#include <FlexCAN_T4.h>
+
+#ifndef CAN_ERRORS_H
+#define CAN_ERRORS_H
+
+/*
+Watches the FlexCAN error state and gets us back on the bus when it goes wrong.
+The ISR only snapshots ESR1/ECR when they change, so the snapshots are decoded into error
+counters (a lower bound, repeats of the same error between two snapshots coalesce) and the
+live fault state is polled from the register every task() so we still notice bus-off when no
+frames are coming in at all.
+On bus-off the controller gets a chance to recover by itself, after that it is re-initialized
+with an exponential backoff until frames come in again.
+*/
+class CanErrorSupervisor {
+public:
+    enum busState {
+        ERROR_ACTIVE,
+        ERROR_PASSIVE,
+        BUS_OFF,
+        RECOVERING // re-initialized after bus-off, waiting for the first frame
+    };
+
+    struct errorCounters {
+        uint32_t bit;
+        uint32_t ack;
+        uint32_t crc;
+        uint32_t form;
+        uint32_t stuff;
+    };
+
+    struct metrics {
+        busState state;
+        errorCounters total;
+        errorCounters perSecond; // last complete one second window
+
+        uint8_t tec;
+        uint8_t rec;
+        uint8_t tecPeak;
+        uint8_t recPeak;
+        int16_t tecTrend; // change over the last window, positive means getting worse
+        int16_t recTrend;
+
+        uint32_t passiveCount;
+        uint32_t busOffCount;
+        uint32_t reinitCount;
+        uint32_t recoveries;
+        uint32_t lastRecoveryMs; // bus-off until the first frame received afterwards
+        uint32_t maxRecoveryMs;
+    };
+
+    static void task();
+
+    static busState getState();
+    static const metrics &getMetrics();
+
+    static void printMetrics();
+
+private:
+    constexpr static const uint32_t WINDOW_MS = 1000;
+    constexpr static const uint32_t BACKOFF_MIN_MS = 50;
+    constexpr static const uint32_t BACKOFF_MAX_MS = 3200;
+    constexpr static const uint32_t STABLE_MS = 5000; // error active this long resets the backoff
+
+    static metrics stats;
+    static errorCounters window;
+
+    static uint32_t windowStart;
+    static uint8_t windowTec;
+    static uint8_t windowRec;
+
+    static uint32_t busOffSince;
+    static uint32_t nextReinit;
+    static uint32_t backoff;
+    static uint32_t activeSince;
+
+    static void decodeSnapshot(const CAN_error_t &error);
+    static void updateCounters(uint32_t ecr);
+    static void updateState(uint32_t esr1, uint32_t now);
+    static void rollWindow(uint32_t now);
+    static void reinit(uint32_t now);
+};
+
+#endif //CAN_ERRORS_H
\ No newline at end of file
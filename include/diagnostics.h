@@ -0,0 +1,79 @@
+#include <Arduino.h>
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+/*
+UDS ReadDataByIdentifier (0x22) over ISO-TP, so a laptop on the bus can pull what the wheel is
+showing and how its links are doing without a USB cable in the car.
+The request arrives in the CAN interrupt and is only copied there. task() answers it from the
+loop into a fixed buffer and hands that to isotp's writeAsync, so nothing allocates and the
+display is never waited on.
+Requests have to fit in a single frame, which is up to three identifiers at once.
+
+  0xF200 live state, 15 bytes
+         water temp C, oil temp C, oil pressure PSI (2), battery 0.1V (2, signed),
+         RPM (2), lambda 0.001 (2, signed), gear (ASCII), neutral, warning mask,
+         CAN active, current page
+  0xF201 CAN stats, 10 + 6 per decoded ID
+         frames received (4), bus state, TEC, REC, bus off count (2),
+         ID count, then per ID: id (2), frames (4)
+  0xF202 display link, 28 bytes
+         messages (4), bytes (4), baud (4), dropped commands (4), failed commands (4),
+         unanswered commands (4), display buffer overflows (4)
+
+Everything is big endian. Unknown identifiers are left out of the answer, if none of them
+is known the answer is 7F 22 31.
+*/
+class DiagnosticService {
+public:
+    constexpr static const uint32_t REQUEST_ID = 0x6F8;
+    constexpr static const uint32_t RESPONSE_ID = 0x6F9;
+
+    static void init();
+
+    static void task();
+
+    // from the isotp receive callback, in the CAN interrupt
+    static void onRequest(uint32_t id, const uint8_t *buf, uint8_t len);
+
+private:
+    constexpr static const uint8_t READ_DATA_BY_ID = 0x22;
+    constexpr static const uint8_t POSITIVE_RESPONSE = 0x40; // added to the service id
+    constexpr static const uint8_t NEGATIVE_RESPONSE = 0x7F;
+
+    constexpr static const uint8_t NRC_SERVICE_NOT_SUPPORTED = 0x11;
+    constexpr static const uint8_t NRC_INCORRECT_LENGTH = 0x13;
+    constexpr static const uint8_t NRC_RESPONSE_TOO_LONG = 0x14;
+    constexpr static const uint8_t NRC_OUT_OF_RANGE = 0x31;
+
+    constexpr static const uint16_t MAX_RESPONSE = 128;
+
+    // writes one identifier's record, returns its length or 0 if it doesn't fit in room
+    typedef uint16_t (*recordReader)(uint8_t *out, uint16_t room);
+
+    struct dataIdentifier {
+        uint16_t id;
+        recordReader read;
+    };
+
+    static const dataIdentifier identifiers[];
+
+    static volatile bool requestPending;
+    static volatile uint8_t requestLength;
+    static volatile uint8_t request[7];
+
+    static uint8_t response[MAX_RESPONSE];
+
+    static uint16_t buildResponse(const uint8_t *req, uint8_t len);
+    static uint16_t negativeResponse(uint8_t service, uint8_t code);
+
+    static uint16_t readLiveState(uint8_t *out, uint16_t room);
+    static uint16_t readCanStats(uint8_t *out, uint16_t room);
+    static uint16_t readDisplayLink(uint8_t *out, uint16_t room);
+
+    static uint8_t *put16(uint8_t *out, uint16_t value);
+    static uint8_t *put32(uint8_t *out, uint32_t value);
+};
+
+#endif //DIAGNOSTICS_H
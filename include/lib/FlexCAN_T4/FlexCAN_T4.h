@@ -199,6 +199,13 @@ typedef struct CANFD_timings_t {
   FLEXCAN_CLOCK clock = CLK_24MHz; 
 } CANFD_timings_t;
 
+typedef struct CANFD_bittiming_t { /* solved register values, see canfd_bittiming() */
+  uint32_t cbt = 0; /* nominal (arbitration) phase, 0 if no timing was found */
+  uint32_t fdcbt = 0; /* data phase */
+  uint32_t tdc = 0; /* TDCEN/TDCOFF bits of FDCTRL */
+  FLEXCAN_CLOCK clock = CLK_24MHz;
+} CANFD_bittiming_t;
+
 typedef enum FLEXCAN_IDE {
   NONE = 0,
   EXT = 1,
@@ -297,15 +304,18 @@ typedef enum CAN_DEV_TABLE {
 #endif
 } CAN_DEV_TABLE;
 
-#define FCTP_CLASS template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize = RX_SIZE_16, FLEXCAN_TXQUEUE_TABLE _txSize = TX_SIZE_16>
-#define FCTP_FUNC template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize, FLEXCAN_TXQUEUE_TABLE _txSize>
-#define FCTP_OPT FlexCAN_T4<_bus, _rxSize, _txSize>
+template<typename... _handlers> struct CANStaticListeners; /* compile-time listener set, see below */
+
+#define FCTP_CLASS template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize = RX_SIZE_16, FLEXCAN_TXQUEUE_TABLE _txSize = TX_SIZE_16, typename _listeners = CANStaticListeners<>>
+#define FCTP_FUNC template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize, FLEXCAN_TXQUEUE_TABLE _txSize, typename _listeners>
+#define FCTP_OPT FlexCAN_T4<_bus, _rxSize, _txSize, _listeners>
 
 #define FCTPFD_CLASS template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize = RX_SIZE_16, FLEXCAN_TXQUEUE_TABLE _txSize = TX_SIZE_16>
 #define FCTPFD_FUNC template<CAN_DEV_TABLE _bus, FLEXCAN_RXQUEUE_TABLE _rxSize, FLEXCAN_TXQUEUE_TABLE _txSize>
 #define FCTPFD_OPT FlexCAN_T4FD<_bus, _rxSize, _txSize>
 
 #define SIZE_LISTENERS 4
+#define SIZE_ID_HANDLERS 64 /* slots in the per-ID hash table, must be a power of 2 */
 
 class CANListener {
   public:
@@ -320,6 +330,38 @@ class CANListener {
     bool generalCallbackActive = 0;
 };
 
+/*
+  Compile-time alternative to CANListener. The handler set is fixed by the 4th FlexCAN_T4 template
+  argument, so dispatch is resolved and inlined by the compiler instead of walking the listener[]
+  slots with virtual calls and a frame copy in the ISR. Attached CANListener objects still work.
+
+  struct MyHandler : CANStaticListener {
+    static const uint64_t mailboxes = (1ULL << MB4); // per-mailbox frames (bit 0 is also the FIFO)
+    static const bool general = 1; // every frame, mailbox reported as -1
+    static void frameHandler(const CAN_message_t &frame, int mailbox, uint8_t controller) { ... }
+  };
+  FlexCAN_T4<CAN2, RX_SIZE_256, TX_SIZE_16, CANStaticListeners<MyHandler, OtherHandler>> myCan;
+*/
+struct CANStaticListener {
+  static const uint64_t mailboxes = 0;
+  static const bool general = 0;
+};
+
+template<> struct CANStaticListeners<> {
+  static inline void dispatch(const CAN_message_t &msg) { ; }
+};
+
+template<typename _first, typename... _rest> struct CANStaticListeners<_first, _rest...> {
+  static inline __attribute__((always_inline)) void dispatch(const CAN_message_t &msg) {
+    if ( _first::mailboxes ) {
+      uint8_t slot = ( msg.mb == FIFO ) ? 0 : msg.mb;
+      if ( slot < 64 && (_first::mailboxes & (1ULL << slot)) ) _first::frameHandler(msg, msg.mb, msg.bus);
+    }
+    if ( _first::general ) _first::frameHandler(msg, -1, msg.bus);
+    CANStaticListeners<_rest...>::dispatch(msg);
+  }
+};
+
 class FlexCAN_T4_Base {
   public:
     virtual void flexcan_interrupt() = 0;
@@ -328,7 +370,9 @@ class FlexCAN_T4_Base {
     virtual int write(const CANFD_message_t &msg) = 0;
     virtual int write(const CAN_message_t &msg) = 0;
     virtual bool isFD() = 0;
+    virtual uint8_t getBusNumber() = 0; /* the msg.bus this controller stamps on received frames */
     virtual uint8_t getFirstTxBoxSize();
+    virtual uint8_t freeTxMailboxes() = 0;
 };
 
 #if defined(__IMXRT1062__)
@@ -353,6 +397,7 @@ FCTPFD_CLASS class FlexCAN_T4FD : public FlexCAN_T4_Base {
   public:
     FlexCAN_T4FD();
     bool isFD() { return 1; }
+    uint8_t getBusNumber() { return busNumber; }
     void begin();
     void setTX(FLEXCAN_PINS pin = DEF);
     void setRX(FLEXCAN_PINS pin = DEF);
@@ -369,6 +414,7 @@ FCTPFD_CLASS class FlexCAN_T4FD : public FlexCAN_T4_Base {
     bool setBaudRateAdvanced(CANFD_timings_t config, uint8_t nominal_choice, uint8_t flexdata_choice, FLEXCAN_RXTX listen_only = TX);
     bool setBaudRate(CANFD_timings_t config, FLEXCAN_RXTX listen_only = TX);
     void setBaudRate(FLEXCAN_FDRATES input, FLEXCAN_RXTX listen_only = TX);
+    bool setBaudRate(const CANFD_bittiming_t &timing, FLEXCAN_RXTX listen_only = TX); /* registers solved by canfd_bittiming() */
     void enableMBInterrupt(const FLEXCAN_MAILBOX &mb_num, bool status = 1);
     void disableMBInterrupt(const FLEXCAN_MAILBOX &mb_num) { enableMBInterrupt(mb_num, 0); }
     void enableMBInterrupts(bool status = 1);
@@ -390,6 +436,7 @@ FCTPFD_CLASS class FlexCAN_T4FD : public FlexCAN_T4_Base {
     void enableDMA(bool state = 1);
     void disableDMA() { enableDMA(0); }
     uint8_t getFirstTxBoxSize();
+    uint8_t freeTxMailboxes(); /* idle transmit mailboxes, lets senders pace themselves */
     void setMBFilterProcessing(FLEXCAN_MAILBOX mb_num, uint32_t filter_id, uint32_t calculated_mask);
 
   private:
@@ -436,9 +483,11 @@ FCTP_CLASS class FlexCAN_T4 : public FlexCAN_T4_Base {
   public:
     FlexCAN_T4();
     CANListener *listener[SIZE_LISTENERS];
+    uint8_t listenerCount = 0; /* attached CANListener objects, 0 skips the virtual dispatch */
     bool attachObj (CANListener *listener);
     bool detachObj (CANListener *listener);
     bool isFD() { return 0; }
+    uint8_t getBusNumber() { return busNumber; }
     void begin();
     uint32_t getBaudRate() { return currentBitrate; }
     void setTX(FLEXCAN_PINS pin = DEF);
@@ -464,6 +513,8 @@ FCTP_CLASS class FlexCAN_T4 : public FlexCAN_T4_Base {
     void setRRS(bool rrs = 1); /* store remote frames */
     void onReceive(const FLEXCAN_MAILBOX &mb_num, _MB_ptr handler); /* individual mailbox callback function */
     void onReceive(_MB_ptr handler); /* global callback function */
+    bool onReceiveId(uint32_t id, _MB_ptr handler, const FLEXCAN_IDE &ide = STD); /* individual ID callback function, nullptr removes it */
+    uint32_t idFrameCount(uint32_t id, const FLEXCAN_IDE &ide = STD); /* frames dispatched to an onReceiveId handler, 0 if not registered */
     void onTransmit(const FLEXCAN_MAILBOX &mb_num, _MB_ptr handler); /* individual mailbox callback function */
     void onTransmit(_MB_ptr handler); /* global callback function */
     bool setMBUserFilter(FLEXCAN_MAILBOX mb_num, uint32_t id1, uint32_t mask);
@@ -508,9 +559,12 @@ FCTP_CLASS class FlexCAN_T4 : public FlexCAN_T4_Base {
     void enableDMA(bool state = 1);
     void disableDMA() { enableDMA(0); }
     uint8_t getFirstTxBoxSize(){ return 8; }
+    uint8_t freeTxMailboxes(); /* idle transmit mailboxes, 0 while frames are still queued for one, lets senders pace themselves */
     void FLEXCAN_ExitFreezeMode();
     void FLEXCAN_EnterFreezeMode();
     bool error(CAN_error_t &error, bool printDetails);
+    uint32_t getESR1() { return FLEXCANb_ESR1(_bus); } /* live status, error() only sees snapshots taken in the ISR */
+    uint32_t getECR() { return FLEXCANb_ECR(_bus); } /* live TX/RX error counters */
     uint32_t getRXQueueCount() { return rxBuffer.size(); }
     uint32_t getTXQueueCount() { return txBuffer.size(); }
 
@@ -543,6 +597,13 @@ FCTP_CLASS class FlexCAN_T4 : public FlexCAN_T4_Base {
     int getFirstTxBox();
     _MB_ptr _mbHandlers[64]; /* individual mailbox handlers */
     _MB_ptr _mainHandler; /* global mailbox handler */
+    uint32_t _idKeys[SIZE_ID_HANDLERS]; /* id | extended << 31, 0xFFFFFFFF when empty */
+    _MB_ptr _idHandlers[SIZE_ID_HANDLERS]; /* individual ID handlers, perfect hashed on _idKeys */
+    volatile uint32_t _idFrames[SIZE_ID_HANDLERS]; /* frames dispatched per ID, moved along when the table is rebuilt */
+    uint32_t _idHashSeed = 0;
+    uint8_t _idHashShift = 31;
+    uint8_t _idCount = 0;
+    bool buildIdTable(const uint32_t *keys, _MB_ptr const *handlers, const uint32_t *frames, uint8_t count);
     _MB_ptr _mbTxHandlers[64]; /* individual mailbox tx handlers */
     _MB_ptr _mainTxHandler; /* global mailbox handler */
     uint64_t readIFLAG();// { return (((uint64_t)FLEXCANb_IFLAG2(_bus) << 32) | FLEXCANb_IFLAG1(_bus)); }
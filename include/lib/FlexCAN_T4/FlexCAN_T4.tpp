@@ -93,6 +93,7 @@ FCTP_FUNC uint32_t FCTP_OPT::getClock() {
 FCTP_FUNC void FCTP_OPT::begin() {
 
   for (uint8_t i = 0; i < SIZE_LISTENERS; i++) listener[i] = nullptr;
+  listenerCount = 0;
 
 #if defined(__IMXRT1062__)
   if ( !getClock() ) setClock(CLK_24MHz); /* no clock enabled, enable osc clock */
@@ -1057,6 +1058,15 @@ FCTP_FUNC int FCTP_OPT::write(const CAN_message_t &msg) {
   return struct2queueTx(msg_copy); /* queue if no mailboxes found */
 }
 
+FCTP_FUNC uint8_t FCTP_OPT::freeTxMailboxes() {
+  if ( txBuffer.size() ) return 0; /* queued frames get the next free mailbox */
+  uint8_t count = 0;
+  for (uint8_t i = mailboxOffset(); i < FLEXCANb_MAXMB_SIZE(_bus); i++) {
+    if ( FLEXCAN_get_code(FLEXCANb_MBn_CS(_bus, i)) == FLEXCAN_MB_CODE_TX_INACTIVE ) count++;
+  }
+  return count;
+}
+
 FCTP_FUNC void FCTP_OPT::onReceive(const FLEXCAN_MAILBOX &mb_num, _MB_ptr handler) {
   if ( FIFO == mb_num ) {
     _mbHandlers[0] = handler;
@@ -1069,6 +1079,80 @@ FCTP_FUNC void FCTP_OPT::onReceive(_MB_ptr handler) {
   _mainHandler = handler;
 }
 
+FCTP_FUNC bool FCTP_OPT::onReceiveId(uint32_t id, _MB_ptr handler, const FLEXCAN_IDE &ide) {
+  uint32_t key = (id & 0x1FFFFFFF) | ((ide == EXT) ? (1UL << 31) : 0);
+  uint32_t keys[SIZE_ID_HANDLERS];
+  _MB_ptr handlers[SIZE_ID_HANDLERS];
+  uint32_t frames[SIZE_ID_HANDLERS];
+  uint32_t replacedFrames = 0;
+  uint8_t count = 0;
+  for ( uint8_t i = 0; _idCount && i < (1UL << (32 - _idHashShift)); i++ ) { /* collect current entries except this id */
+    if ( _idKeys[i] == 0xFFFFFFFF ) continue;
+    if ( _idKeys[i] == key ) {
+      replacedFrames = _idFrames[i]; /* a new handler for the same id keeps counting */
+      continue;
+    }
+    keys[count] = _idKeys[i];
+    handlers[count] = _idHandlers[i];
+    frames[count++] = _idFrames[i];
+  }
+  if ( handler ) {
+    if ( count >= SIZE_ID_HANDLERS / 2 ) return 0; /* keep the table at most half full */
+    keys[count] = key;
+    handlers[count] = handler;
+    frames[count++] = replacedFrames;
+  }
+  return buildIdTable(keys, handlers, frames, count);
+}
+
+FCTP_FUNC uint32_t FCTP_OPT::idFrameCount(uint32_t id, const FLEXCAN_IDE &ide) {
+  if ( !_idCount ) return 0;
+  uint32_t key = (id & 0x1FFFFFFF) | ((ide == EXT) ? (1UL << 31) : 0);
+  uint8_t slot = (key * _idHashSeed) >> _idHashShift;
+  return ( _idKeys[slot] == key ) ? _idFrames[slot] : 0;
+}
+
+FCTP_FUNC bool FCTP_OPT::buildIdTable(const uint32_t *keys, _MB_ptr const *handlers, const uint32_t *frames, uint8_t count) {
+  /* search for a multiplier that maps every registered key to its own slot, so dispatch is
+     one multiply, one compare and one call no matter how many IDs are registered */
+  for ( uint8_t bits = 1; (1UL << bits) <= SIZE_ID_HANDLERS; bits++ ) {
+    uint32_t size = (1UL << bits);
+    if ( size < 2UL * count ) continue;
+    uint32_t seed = 0x9E3779B1; /* golden ratio, then an LCG for the next candidates */
+    for ( uint16_t attempt = 0; attempt < 2048; attempt++, seed = (seed * 1664525UL + 1013904223UL) | 1 ) {
+      uint64_t used = 0;
+      bool collision = 0;
+      for ( uint8_t i = 0; i < count; i++ ) {
+        uint8_t slot = (keys[i] * seed) >> (32 - bits);
+        if ( used & (1ULL << slot) ) {
+          collision = 1;
+          break;
+        }
+        used |= (1ULL << slot);
+      }
+      if ( collision ) continue;
+      if ( nvicIrq ) NVIC_DISABLE_IRQ(nvicIrq);
+      for ( uint8_t i = 0; i < SIZE_ID_HANDLERS; i++ ) {
+        _idKeys[i] = 0xFFFFFFFF;
+        _idHandlers[i] = nullptr;
+        _idFrames[i] = 0;
+      }
+      for ( uint8_t i = 0; i < count; i++ ) {
+        uint8_t slot = (keys[i] * seed) >> (32 - bits);
+        _idKeys[slot] = keys[i];
+        _idHandlers[slot] = handlers[i];
+        _idFrames[slot] = frames[i];
+      }
+      _idHashSeed = seed;
+      _idHashShift = 32 - bits;
+      _idCount = count;
+      if ( nvicIrq ) NVIC_ENABLE_IRQ(nvicIrq);
+      return 1;
+    }
+  }
+  return 0; /* no perfect hash found, table left unchanged */
+}
+
 FCTP_FUNC void FCTP_OPT::onTransmit(const FLEXCAN_MAILBOX &mb_num, _MB_ptr handler) {
   if ( FIFO == mb_num ) {
     _mbTxHandlers[0] = handler;
@@ -1144,6 +1228,14 @@ static void flexcan_isr_can1() {
 
 
 FCTP_FUNC void FCTP_OPT::mbCallbacks(const FLEXCAN_MAILBOX &mb_num, const CAN_message_t &msg) {
+  if ( _idCount ) {
+    uint32_t key = msg.id | ((uint32_t)msg.flags.extended << 31);
+    uint8_t slot = (key * _idHashSeed) >> _idHashShift;
+    if ( _idKeys[slot] == key ) {
+      _idFrames[slot]++;
+      _idHandlers[slot](msg);
+    }
+  }
   if ( mb_num == FIFO ) {
     if ( _mbHandlers[0] ) _mbHandlers[0](msg);
     if ( _mainHandler ) _mainHandler(msg);
@@ -1154,13 +1246,16 @@ FCTP_FUNC void FCTP_OPT::mbCallbacks(const FLEXCAN_MAILBOX &mb_num, const CAN_me
 }
 
 FCTP_FUNC void FCTP_OPT::struct2queueRx(const CAN_message_t &msg) {
-  CANListener *thisListener;
-  CAN_message_t cl = msg;
-  for (uint8_t listenerPos = 0; listenerPos < SIZE_LISTENERS; listenerPos++) {
-    thisListener = listener[listenerPos];
-    if (thisListener != nullptr) {
-      if (thisListener->callbacksActive & (1UL << cl.mb)) thisListener->frameHandler (cl, cl.mb, cl.bus);
-      if (thisListener->generalCallbackActive) thisListener->frameHandler (cl, -1, cl.bus);
+  _listeners::dispatch(msg); /* compile-time listeners, inlined */
+  if ( listenerCount ) { /* dynamic CANListener objects */
+    CANListener *thisListener;
+    CAN_message_t cl = msg;
+    for (uint8_t listenerPos = 0; listenerPos < SIZE_LISTENERS; listenerPos++) {
+      thisListener = listener[listenerPos];
+      if (thisListener != nullptr) {
+        if (thisListener->callbacksActive & (1UL << cl.mb)) thisListener->frameHandler (cl, cl.mb, cl.bus);
+        if (thisListener->generalCallbackActive) thisListener->frameHandler (cl, -1, cl.bus);
+      }
     }
   }
   if ( !isEventsUsed ) {
@@ -1343,7 +1438,7 @@ FCTP_FUNC bool FCTP_OPT::error(CAN_error_t &error, bool printDetails) {
   error.RX_WRN = (error.ESR1 & (1UL << 8)) ? 1 : 0;
 
   if ( (error.ESR1 & 0x30) == 0x0 ) strncpy((char*)error.FLT_CONF, "Error Active", (sizeof(error.FLT_CONF) - 1));
-  else if ( (error.ESR1 & 0x30) == 0x1 ) strncpy((char*)error.FLT_CONF, "Error Passive", (sizeof(error.FLT_CONF) - 1));
+  else if ( (error.ESR1 & 0x30) == 0x10 ) strncpy((char*)error.FLT_CONF, "Error Passive", (sizeof(error.FLT_CONF) - 1));
   else strncpy((char*)error.FLT_CONF, "Bus off", (sizeof(error.FLT_CONF) - 1));
 
   error.RX_ERR_COUNTER = (uint8_t)(error.ECR >> 8);
@@ -1785,6 +1880,7 @@ FCTP_FUNC bool FCTP_OPT::attachObj (CANListener *listener) {
     if (this->listener[i] == nullptr) {
       this->listener[i] = listener;
       listener->callbacksActive = 0;
+      listenerCount++;
       return true;
     }
   }
@@ -1795,6 +1891,7 @@ FCTP_FUNC bool FCTP_OPT::detachObj (CANListener *listener) {
   for (uint8_t i = 0; i < SIZE_LISTENERS; i++) {
     if (this->listener[i] == listener) {
       this->listener[i] = nullptr;
+      listenerCount--;
       return true;
     }
   }
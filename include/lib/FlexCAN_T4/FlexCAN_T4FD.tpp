@@ -182,6 +182,16 @@ FCTPFD_FUNC uint8_t FCTPFD_OPT::getFirstTxBoxSize() {
   return mbsize;
 }
 
+FCTPFD_FUNC uint8_t FCTPFD_OPT::freeTxMailboxes() {
+  uint8_t count = 0;
+  for (uint8_t i = 0, mbsize = 0; i < max_mailboxes(); i++) {
+    if (readIMASK() & (1ULL << i)) continue; /* interrupt enabled mailboxes are not used by write() */
+    volatile uint32_t *mbxAddr = &(*(volatile uint32_t*)(mailbox_offset(i, mbsize)));
+    if ( FLEXCAN_get_code(mbxAddr[0]) == FLEXCAN_MB_CODE_TX_INACTIVE ) count++;
+  }
+  return count;
+}
+
 FCTPFD_FUNC void FCTPFD_OPT::setBaudRate(FLEXCAN_FDRATES input, FLEXCAN_RXTX listen_only) {
   bool frz_flag_negate = !(FLEXCANb_MCR(_bus) & FLEXCAN_MCR_FRZ_ACK);
   FLEXCAN_EnterFreezeMode();
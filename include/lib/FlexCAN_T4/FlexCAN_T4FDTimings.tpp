@@ -2,12 +2,144 @@
 #include "imxrt_flexcan.h"
 #include "Arduino.h"
 
+/*
+  Compile-time version of the solver below. It walks the same prescaler/NBT/propseg/pseg search with
+  the same double math, but stops at the first hit, which is choice 1 of setBaudRateAdvanced().
+  Used in a constexpr context it costs nothing at runtime, and a config without any valid timing does
+  not compile (the error points at one of the *_not_possible functions):
+
+    constexpr CANFD_bittiming_t timing = canfd_bittiming({ 1000000, 4000000, 190, 1, 70, CLK_24MHz });
+    myFD.setBaudRate(timing);
+
+  Called at runtime it returns a zeroed CANFD_bittiming_t instead.
+*/
+constexpr double canfd_ceil(double x) {
+  return ( x > (double)(int64_t)x ) ? (double)((int64_t)x + 1) : (double)(int64_t)x;
+}
+
+constexpr double canfd_round(double x) { /* halfway cases away from zero, like round() */
+  return ( x < 0 ) ? -(double)(int64_t)(-x + 0.5) : (double)(int64_t)(x + 0.5);
+}
+
+constexpr double canfd_min(double a, double b) {
+  return ( a <= b ) ? a : b;
+}
+
+inline uint32_t canfd_nominal_timing_not_possible() { return 0; } /* not constexpr on purpose */
+inline CANFD_bittiming_t canfd_flexdata_timing_not_possible() { return CANFD_bittiming_t(); } /* not constexpr on purpose */
+
+constexpr uint32_t canfd_cbt(double prescaler, double propseg, double pseg_1, double pseg_2, double rjw) {
+  return ((uint32_t)(propseg - 1) << 10) | /* EPROPSEG */
+         ((uint32_t)(pseg_2 - 1) << 0) | /* EPSEG2 */
+         ((uint32_t)(pseg_1 - 1) << 5) | /* EPSEG1 */
+         ((uint32_t)(rjw - 1) << 16) | /* ERJW */
+         ((uint32_t)(prescaler - 1) << 21) | /* EPRESDIV */
+         (1UL << 31); /* BTF */
+}
+
+constexpr uint32_t canfd_fdcbt(double prescaler, double propseg, double pseg_1, double pseg_2, double rjw) {
+  return ((uint32_t)(pseg_2 - 1) << 0) | /* FPSEG2 */
+         ((uint32_t)(pseg_1 - 1) << 5) | /* FPSEG1 */
+         ((uint32_t)(propseg - 0) << 10) | /* FPROPSEG */
+         ((uint32_t)(rjw - 1) << 16) | /* FRJW */
+         ((uint32_t)(prescaler - 1) << 20); /* FPRESDIV */
+}
+
+constexpr uint32_t canfd_nominal_cbt(const CANFD_timings_t &config) {
+  double cpi_clock = config.clock, req_smp = config.sample;
+  double ratio = cpi_clock * 1000 / (config.baudrate / 1000);
+  double propdelay = (config.propdelay * 2) + (config.bus_length * 10);
+  for ( uint32_t prescaler = 1; prescaler < 1024 && req_smp != 0; prescaler++ ) {
+    double nbt = ratio / prescaler;
+    if ( nbt < 8 || nbt >= 129 || nbt != (double)(uint32_t)nbt ) continue;
+    double propseg = canfd_ceil(propdelay / 1000 * cpi_clock / prescaler);
+    if ( propseg > 64 ) continue;
+    double pseg_1 = canfd_round((nbt * req_smp / 100) - 1 - propseg);
+    double pseg_2 = nbt - 1 - propseg - pseg_1;
+    if ( pseg_2 >= 2 && pseg_2 <= 32 && pseg_1 > 0 && pseg_1 <= 32 ) return canfd_cbt(prescaler, propseg, pseg_1, pseg_2, canfd_min(pseg_2, 16));
+    double pseg = nbt - 1 - propseg;
+    if ( pseg == 3 ) return canfd_cbt(prescaler, propseg, 1, 2, 1);
+    if ( pseg > 3 && pseg <= 64 ) { /* split what is left evenly */
+      if ( (uint32_t)pseg % 2 != 0 ) propseg++;
+      pseg = (nbt - 1 - propseg) / 2;
+      return canfd_cbt(prescaler, propseg, pseg, nbt - 1 - propseg - pseg, canfd_min(pseg, 16));
+    }
+  }
+  return canfd_nominal_timing_not_possible();
+}
+
+constexpr CANFD_bittiming_t canfd_flexdata_timing(const CANFD_timings_t &config) {
+  CANFD_bittiming_t timing;
+  double cpi_clock = config.clock, req_smp = config.sample;
+  double baudrate = config.baudrateFD / 1000;
+  double ratio = cpi_clock * 1000 / baudrate;
+  for ( uint32_t prescaler = 1; prescaler < 1024; prescaler++ ) {
+    double nbt = ratio / prescaler;
+    if ( nbt < 5 || nbt >= 48 || nbt != (double)(uint32_t)nbt ) continue;
+    double propseg = canfd_ceil(config.propdelay / 1000 * cpi_clock / prescaler);
+    timing.tdc = 0;
+    if ( propseg >= (nbt - 2) ) { /* delay longer than the bit, rely on transceiver delay compensation */
+      double ppsegmax = nbt - 3, ppsegmin = nbt - 1 - 8 - 8;
+      if ( ppsegmin < 1 ) ppsegmin = 1;
+      propseg = canfd_round((ppsegmax - ppsegmin) / 2);
+      timing.tdc = (1UL << 15) | ((uint32_t)(cpi_clock / (2 * baudrate / 1000)) << 8);
+    }
+    if ( propseg > 32 ) continue;
+    double pseg_1 = canfd_round((nbt * req_smp / 100) - 1 - propseg);
+    double pseg_2 = nbt - 1 - propseg - pseg_1;
+    double pseg = nbt - 1 - propseg;
+    if ( pseg_2 >= 2 && pseg_2 <= 8 && pseg_1 > 0 && pseg_1 <= 8 ) timing.fdcbt = canfd_fdcbt(prescaler, propseg, pseg_1, pseg_2, canfd_min(pseg_2, 8));
+    else if ( pseg == 3 ) timing.fdcbt = canfd_fdcbt(prescaler, propseg, 1, 2, 1);
+    else if ( pseg > 3 && pseg <= 16 ) {
+      if ( (uint32_t)pseg % 2 != 0 ) propseg++;
+      pseg = (nbt - 1 - propseg) / 2;
+      timing.fdcbt = canfd_fdcbt(prescaler, propseg, pseg, pseg, canfd_min(pseg, 8));
+    }
+    else continue;
+    return timing;
+  }
+  return canfd_flexdata_timing_not_possible();
+}
+
+constexpr CANFD_bittiming_t canfd_bittiming(const CANFD_timings_t &config) {
+  CANFD_bittiming_t timing = canfd_flexdata_timing(config);
+  timing.cbt = canfd_nominal_cbt(config);
+  timing.clock = config.clock;
+  if ( !timing.cbt || !timing.fdcbt ) timing = CANFD_bittiming_t();
+  return timing;
+}
+
+/* the presets in setBaudRate(FLEXCAN_FDRATES) are what the solver picks for them. Their TDC offsets were tuned by hand, only CAN_1M_4M matches the solver there */
+static_assert(canfd_bittiming({ 1000000, 2000000, 190, 1, 70, CLK_24MHz }).cbt == 0x800624A6, "CAN_1M_2M nominal timing");
+static_assert(canfd_bittiming({ 1000000, 2000000, 190, 1, 70, CLK_24MHz }).fdcbt == 0x31423, "CAN_1M_2M data timing");
+static_assert(canfd_bittiming({ 1000000, 4000000, 190, 1, 70, CLK_24MHz }).cbt == 0x800624A6, "CAN_1M_4M nominal timing");
+static_assert(canfd_bittiming({ 1000000, 4000000, 190, 1, 70, CLK_24MHz }).fdcbt == 0x10421, "CAN_1M_4M data timing");
+static_assert(canfd_bittiming({ 1000000, 4000000, 190, 1, 70, CLK_24MHz }).tdc == 0x8300, "CAN_1M_4M delay compensation");
+static_assert(canfd_bittiming({ 1000000, 6000000, 190, 1, 70, CLK_30MHz }).cbt == 0x80082CE8, "CAN_1M_6M nominal timing");
+static_assert(canfd_bittiming({ 1000000, 6000000, 190, 1, 70, CLK_30MHz }).fdcbt == 0x401, "CAN_1M_6M data timing");
+static_assert(canfd_bittiming({ 1000000, 8000000, 190, 1, 70, CLK_40MHz }).cbt == 0x800B3D4B, "CAN_1M_8M nominal timing");
+static_assert(canfd_bittiming({ 1000000, 8000000, 190, 1, 70, CLK_40MHz }).fdcbt == 0x401, "CAN_1M_8M data timing");
+
 FCTPFD_FUNC bool FCTPFD_OPT::setBaudRateAdvanced(CANFD_timings_t config, uint8_t nominal_choice, uint8_t flexdata_choice, FLEXCAN_RXTX listen_only) {
   return setBaudRate(config, nominal_choice, flexdata_choice, listen_only, 1);
 }
 
 FCTPFD_FUNC bool FCTPFD_OPT::setBaudRate(CANFD_timings_t config, FLEXCAN_RXTX listen_only) {
-  return setBaudRate(config, 1, 1, listen_only, 0);
+  return setBaudRate(canfd_bittiming(config), listen_only);
+}
+
+FCTPFD_FUNC bool FCTPFD_OPT::setBaudRate(const CANFD_bittiming_t &timing, FLEXCAN_RXTX listen_only) {
+  if ( !timing.cbt ) return 0;
+  bool frz_flag_negate = !(FLEXCANb_MCR(_bus) & FLEXCAN_MCR_FRZ_ACK);
+  FLEXCAN_EnterFreezeMode();
+  setClock(timing.clock);
+  FLEXCANb_FDCTRL(_bus) = (FLEXCANb_FDCTRL(_bus) & 0xFFFF60FF) | timing.tdc; /* replace TDC values */
+  FLEXCANb_CBT(_bus) &= ~(1UL << 31); /* clear BTE bit to edit CTRL1 register */
+  ( listen_only != LISTEN_ONLY ) ? FLEXCANb_CTRL1(_bus) &= ~FLEXCAN_CTRL_LOM : FLEXCANb_CTRL1(_bus) |= FLEXCAN_CTRL_LOM;
+  FLEXCANb_FDCBT(_bus) = timing.fdcbt;
+  FLEXCANb_CBT(_bus) = timing.cbt;
+  if ( frz_flag_negate ) FLEXCAN_ExitFreezeMode();
+  return 1;
 }
 
 FCTPFD_FUNC bool FCTPFD_OPT::setBaudRate(CANFD_timings_t config, uint8_t nominal_choice, uint8_t flexdata_choice, FLEXCAN_RXTX listen_only, bool advanced) {
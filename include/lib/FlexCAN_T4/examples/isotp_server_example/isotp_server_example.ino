@@ -3,7 +3,7 @@
 const uint32_t canid = 0x666;
 const uint32_t request = 0x020902;
 uint8_t myData[] = { 0x49, 0x2, 0x1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 1, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 3, 3, 2, 4, 4, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0x5 };
-isotp_server<canid, STANDARD_ID, request, myData, sizeof(myData)> myResource;
+isotp_server<> myServer;
 
 FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> Can1;
 
@@ -30,9 +30,11 @@ void setup() {
   Can1.enableFIFO();
   Can1.enableFIFOInterrupt();
   Can1.onReceive(canSniff);
-  myResource.begin();
-  myResource.setWriteBus(&Can1); /* we write to this bus */
+  myServer.begin();
+  myServer.setWriteBus(&Can1); /* we write to this bus */
+  myServer.addBuffer(canid, STANDARD_ID, request, myData, sizeof(myData));
 }
 
 void loop() {
+  myServer.events(); /* responses are sent from here */
 }
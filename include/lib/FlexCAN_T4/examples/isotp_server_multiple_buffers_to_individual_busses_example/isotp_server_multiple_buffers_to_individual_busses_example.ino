@@ -5,9 +5,7 @@ const uint32_t request = 0x020902;
 uint8_t myData[] = { 0x49, 0x2, 0x1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 1, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 3, 3, 2, 4, 4, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0x5 };
 uint8_t myData2[] = { 0x7, 0x3, 0x2, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 1, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 3, 3, 2, 4, 4, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0x5 };
 uint8_t myData3[] = { 9, 9, 9, 1, 2,3,4,5,6,7,8,9,0,0,0,3 };
-isotp_server<canid, STANDARD_ID, request, myData, sizeof(myData)> myResource;
-isotp_server<0x555, STANDARD_ID, 0x022222, myData2, sizeof(myData2)> myResource2;
-isotp_server<0x133, STANDARD_ID, 0x010201, myData3, sizeof(myData3)> myResource3;
+isotp_server<> myServer; /* up to 16 buffers, isotp_server<32> for more */
 
 FlexCAN_T4<CAN1, RX_SIZE_256, TX_SIZE_16> Can1;
 
@@ -34,13 +32,13 @@ void setup() {
   Can1.enableFIFO();
   Can1.enableFIFOInterrupt();
   Can1.onReceive(canSniff);
-  myResource.begin();
-  myResource.setWriteBus(&Can1); /* we write response to this bus */
-  myResource2.begin();
-  myResource2.setWriteBus(&Can1); /* we write response to this bus */
-  myResource3.begin();
-  myResource3.setWriteBus(&Can1); /* we write response to this bus */
+  myServer.begin();
+  myServer.setWriteBus(&Can1); /* we write responses to this bus */
+  myServer.addBuffer(canid, STANDARD_ID, request, myData, sizeof(myData));
+  myServer.addBuffer(0x555, STANDARD_ID, 0x022222, myData2, sizeof(myData2));
+  myServer.addBuffer(0x133, STANDARD_ID, 0x010201, myData3, sizeof(myData3));
 }
 
 void loop() {
+  myServer.events(); /* responses are sent from here */
 }
@@ -32,8 +32,8 @@
 #define _ISOTP_H_
 
 #include "Arduino.h"
-#include "circular_buffer.h"
 #include "isotp.h"
+#include "isotp_types.h"
 
 #if defined(TEENSYDUINO) // Teensy
 #include "FlexCAN_T4.h"
@@ -41,38 +41,10 @@
 #include "ESP32_CAN.h"
 #endif
 
-typedef struct ISOTP_data {
-  uint32_t id = 0;                         /* can identifier */
-  struct {
-    bool extended = 0;                     /* identifier is extended (29-bit) */
-    bool usePadding = 0;                   /* padd and use all 8 bytes instead of truncating len */
-    bool separation_uS = 0;                /* separation time in uS (100-900uS only) */
-  } flags;
-  uint16_t len = 8;                        /* length of CAN message or callback payload */
-  uint16_t blockSize = 0;                  /* used for flow control, specify how many frame blocks per frame control request */
-  uint8_t flow_control_type = 0;           /* flow control type: 0: Clear to Send, 1: Wait, 2: Abort */
-  uint16_t separation_time = 0;            /* time between frames */
-} ISOTP_data;
-
-typedef enum ISOTP_RXBANKS_TABLE {
-  RX_BANKS_2 = (uint16_t)2,
-  RX_BANKS_4 = (uint16_t)4,
-  RX_BANKS_8 = (uint16_t)8,
-  RX_BANKS_16 = (uint16_t)16,
-  RX_BANKS_32 = (uint16_t)32,
-  RX_BANKS_64 = (uint16_t)64,
-  RX_BANKS_128 = (uint16_t)128,
-  RX_BANKS_256 = (uint16_t)256,
-  RX_BANKS_512 = (uint16_t)512,
-  RX_BANKS_1024 = (uint16_t)1024
-} ISOTP_RXBANKS_TABLE;
-
 #define ISOTP_CLASS template<ISOTP_RXBANKS_TABLE _rxBanks = RX_BANKS_16, size_t _max_length = 32>
 #define ISOTP_FUNC template<ISOTP_RXBANKS_TABLE _rxBanks, size_t _max_length>
 #define ISOTP_OPT isotp<_rxBanks, _max_length>
 
-typedef void (*_isotp_cb_ptr)(const ISOTP_data &config, const uint8_t *buf);
-
 #if defined(TEENSYDUINO) // Teensy
 static FlexCAN_T4_Base* _isotp_busToWrite = nullptr;
 #elif defined(ARDUINO_ARCH_ESP32) //ESP32
@@ -95,15 +67,7 @@ ISOTP_CLASS class isotp : public isotp_Base {
 #if defined(TEENSYDUINO) // Teensy
     void setWriteBus(FlexCAN_T4_Base* _busWritePtr) { 
       _isotp_busToWrite = _busWritePtr; 
-      #if defined(__IMXRT1062__)
-        if ( _isotp_busToWrite == _CAN1 ) readBus = 1;    
-        if ( _isotp_busToWrite == _CAN2 ) readBus = 2;
-        if ( _isotp_busToWrite == _CAN3 ) readBus = 3;
-      #endif
-      #if defined(__MK20DX256__) || defined(__MK64FX512__) || defined(__MK66FX1M0__)
-        if ( _isotp_busToWrite == _CAN0 ) readBus = 0;    
-        if ( _isotp_busToWrite == _CAN1 ) readBus = 1;
-      #endif
+      readBus = _busWritePtr->getBusNumber(); /* _CANx are per translation unit, ask the controller */
     }
 #elif defined(ARDUINO_ARCH_ESP32) //ESP32
     void setWriteBus(ESP32_CAN_Base* _busWritePtr) { _isotp_busToWrite = _busWritePtr; }
@@ -111,17 +75,61 @@ ISOTP_CLASS class isotp : public isotp_Base {
     void begin() { enable(); }
     void enable(bool yes = 1) { isotp_enabled = yes; }
     void setPadding(uint8_t _byte) { padding_value = _byte; }
+    void setReadId(uint32_t id, bool extended = 0) { readId = id; readExtended = extended; readIdSet = 1; } /* frames with any other id are ignored, before reassembly */
     void onReceive(_isotp_cb_ptr handler) { _ISOTP_OBJ->_isotp_handler = handler; }
     void write(const ISOTP_data &config, const uint8_t *buf, uint16_t size);
     void write(const ISOTP_data &config, const char *buf, uint16_t size) { write(config, (const uint8_t*)buf, size); }
+    bool writeAsync(const ISOTP_data &config, const uint8_t *buf, uint16_t size, _isotp_tx_cb_ptr done = nullptr); /* buf must stay valid until done is called */
+    bool writeBusy() { return _tx.state != TX_IDLE; }
+    void cancelWrite();
+    void events(); /* call from loop(), sends the frames queued by writeAsync */
     void sendFlowControl(const ISOTP_data &config);
 
   private:
     void _process_frame_data(const CAN_message_t &msg);
-    Circular_Buffer<uint8_t, _rxBanks, _max_length> _rx_slots;
+    bool _send_next_frame();
+    void _process_flow_control();
+    void _finish_write(ISOTP_TX_STATUS status);
+    static uint32_t _stmin_to_us(uint8_t stmin);
+    static const uint32_t N_BS_TIMEOUT = 1000; /* ms to wait for flow control */
+    enum { TX_IDLE, TX_SEND, TX_WAIT_FC };
+    struct {
+      ISOTP_data config;
+      const uint8_t *buf = nullptr;
+      uint16_t size = 0;
+      uint16_t sent = 0;                   /* payload bytes already written */
+      uint8_t counter = 1;                 /* sequence number of the next consecutive frame */
+      uint32_t separation_us = 0;          /* ours, the peer's STmin is never undercut */
+      uint32_t peer_separation_us = 0;
+      uint8_t block_size = 0;              /* frames per flow control, 0: no more flow control */
+      uint8_t block_left = 0;
+      uint32_t last_frame = 0;             /* micros() when the last frame was written */
+      uint32_t fc_wait_start = 0;          /* millis() */
+      volatile uint8_t fc[3];              /* latest flow control frame from the interrupt */
+      volatile bool fc_pending = 0;
+      _isotp_tx_cb_ptr done = nullptr;
+      volatile uint8_t state = TX_IDLE;
+    } _tx;
+    static const uint32_t N_CR_TIMEOUT = 1000; /* ms between consecutive frames before a reassembly is dropped */
+    struct {
+      uint32_t id = 0;
+      uint8_t bus = 0;
+      bool extended = 0;
+      bool used = 0;
+      uint8_t sequence = 0;                /* of the last consecutive frame received */
+      uint16_t len = 0;                    /* total payload from the first frame */
+      uint16_t pos = 0;                    /* payload bytes received so far */
+      uint32_t last_frame = 0;             /* millis() */
+      uint8_t data[_max_length];
+    } _rx_slots[_rxBanks];
+    int _find_rx_slot(const CAN_message_t &msg);
+    int _claim_rx_slot(const CAN_message_t &msg);
     uint8_t padding_value = 0xA5;
     volatile bool isotp_enabled = 0;
     uint8_t readBus = 1;
+    uint32_t readId = 0;
+    bool readExtended = 0;
+    bool readIdSet = 0;
 };
 
 #include "isotp.tpp"
@@ -57,51 +57,144 @@ ISOTP_FUNC void ISOTP_OPT::sendFlowControl(const ISOTP_data &config) {
 }
 
 
-ISOTP_FUNC void ISOTP_OPT::write(const ISOTP_data &config, const uint8_t *buf, uint16_t size) {
+ISOTP_FUNC void ISOTP_OPT::write(const ISOTP_data &config, const uint8_t *buf, uint16_t size) { /* blocking, buf may go out of scope after return */
+  while ( writeBusy() ) events();
+  if ( !writeAsync(config, buf, size) ) return;
+  while ( writeBusy() ) {
+    events();
+#if defined(ARDUINO_ARCH_ESP32) //ESP32
+    vTaskDelay(1);
+#endif
+  }
+}
+
+
+ISOTP_FUNC bool ISOTP_OPT::writeAsync(const ISOTP_data &config, const uint8_t *buf, uint16_t size, _isotp_tx_cb_ptr done) {
+  if ( writeBusy() || size > 4095 ) return 0;
+  _tx.config = config;
+  if ( !_tx.config.flow_control_id ) _tx.config.flow_control_id = config.id;
+  _tx.buf = buf;
+  _tx.size = size;
+  _tx.sent = 0;
+  _tx.counter = 1;
+  if ( config.flags.separation_uS ) _tx.separation_us = constrain(config.separation_time, 100, 900);
+  else _tx.separation_us = constrain(config.separation_time, 0, 127) * 1000;
+  _tx.peer_separation_us = 0;
+  _tx.block_size = _tx.block_left = 0;
+  _tx.fc_pending = 0;
+  _tx.done = done;
+  _tx.state = TX_SEND;
+  return 1;
+}
+
+
+ISOTP_FUNC void ISOTP_OPT::cancelWrite() {
+  if ( writeBusy() ) _finish_write(ISOTP_TX_CANCELLED);
+}
+
+
+ISOTP_FUNC void ISOTP_OPT::_finish_write(ISOTP_TX_STATUS status) {
+  _tx.state = TX_IDLE;
+  if ( _tx.done ) _tx.done(_tx.config, status);
+}
+
+
+ISOTP_FUNC uint32_t ISOTP_OPT::_stmin_to_us(uint8_t stmin) {
+  if ( stmin <= 0x7F ) return stmin * 1000;
+  if ( stmin >= 0xF1 && stmin <= 0xF9 ) return (stmin - 0xF0) * 100;
+  return 127000; /* reserved values, use the longest STmin */
+}
+
+
+ISOTP_FUNC void ISOTP_OPT::_process_flow_control() {
+  uint8_t fc[3];
+  noInterrupts();
+  fc[0] = _tx.fc[0]; fc[1] = _tx.fc[1]; fc[2] = _tx.fc[2];
+  _tx.fc_pending = 0;
+  interrupts();
+
+  if ( (fc[0] & 0xF) == 0 ) { /* clear to send */
+    _tx.block_size = _tx.block_left = fc[1];
+    _tx.peer_separation_us = _stmin_to_us(fc[2]);
+    _tx.state = TX_SEND;
+  }
+  else if ( (fc[0] & 0xF) == 1 ) _tx.fc_wait_start = millis(); /* wait, N_Bs starts over */
+  else _finish_write(ISOTP_TX_OVERFLOW); /* overflow/abort */
+}
+
+
+ISOTP_FUNC void ISOTP_OPT::events() {
+  while ( writeBusy() ) {
+    if ( _tx.state == TX_WAIT_FC ) {
+      if ( _tx.fc_pending ) _process_flow_control();
+      else if ( millis() - _tx.fc_wait_start >= N_BS_TIMEOUT ) _finish_write(ISOTP_TX_TIMEOUT);
+      if ( _tx.state != TX_SEND ) return;
+    }
+    uint32_t separation_us = max(_tx.separation_us, _tx.peer_separation_us);
+    if ( _tx.sent && (micros() - _tx.last_frame) < separation_us ) return; /* STmin not over yet */
+#if defined(TEENSYDUINO) // Teensy
+    if ( !_isotp_busToWrite->freeTxMailboxes() ) return; /* don't fill the queue other senders need */
+#endif
+    bool ends_block = !_tx.sent || (_tx.block_size && _tx.block_left == 1); /* the peer tells us how to go on */
+    if ( ends_block ) { /* before the write, its flow control can arrive before write() returns */
+      _tx.fc_wait_start = millis();
+      _tx.state = TX_WAIT_FC;
+    }
+    if ( !_send_next_frame() ) { /* bus refused it, try again on the next call */
+      if ( ends_block ) {
+        _tx.state = TX_SEND;
+        _tx.fc_pending = 0;
+      }
+      return;
+    }
+    _tx.last_frame = micros();
+    if ( _tx.sent >= _tx.size ) { /* a single frame or the last one, no flow control follows */
+      _finish_write(ISOTP_TX_DONE);
+      return;
+    }
+    if ( ends_block ) return;
+    if ( _tx.block_size ) _tx.block_left--;
+    if ( separation_us ) return; /* one frame per call when paced */
+  }
+}
+
+
+ISOTP_FUNC bool ISOTP_OPT::_send_next_frame() {
   CAN_message_t msg;
-  msg.id = config.id;
-  msg.flags.extended = config.flags.extended;
-  if (size < 8) { /* single frame */
+  msg.id = _tx.config.id;
+  msg.flags.extended = _tx.config.flags.extended;
+  uint16_t size = _tx.size;
+  if ( size < 8 ) { /* single frame */
     msg.len = size + 1;
     msg.buf[0] = size & 0x0f;
-    memmove(&msg.buf[1], &buf[0], size);
-   
-    if ( config.flags.usePadding ) {
+    memmove(&msg.buf[1], &_tx.buf[0], size);
+    if ( _tx.config.flags.usePadding ) {
       for ( int i = msg.len; i <= 7; i++ ) msg.buf[i] = padding_value;
       msg.len = 8;
     }
-    _isotp_busToWrite->write(msg);
-    return;
-  } 
-  else { /* first frame */
+    if ( !_isotp_busToWrite->write(msg) ) return 0;
+    _tx.sent = size;
+    return 1;
+  }
+  if ( !_tx.sent ) { /* first frame */
     msg.len = 8;
     msg.buf[0] = (1U << 4) | size >> 8;
     msg.buf[1] = (uint8_t)size;
-    memmove(&msg.buf[2], &buf[0], 6);
-    _isotp_busToWrite->write(msg);
-  }
-	
-#if defined(TEENSYDUINO) // Teensy
-  delay(constrain(config.separation_time, 0, 127));
-#elif defined(ARDUINO_ARCH_ESP32) //ESP32
-  vTaskDelay(constrain(config.separation_time, 0, 127));
-#endif
-
-  for ( int sent_bytes = 6, difference = 7, counter = 1; sent_bytes < size; sent_bytes += 7, counter++ ) {
-    msg.buf[0] = (2U << 4) | (counter & 0xF);
-    difference = constrain((size - sent_bytes), 1, 7);
-    memmove(&msg.buf[1], &buf[sent_bytes], difference);
-    for ( int i = 0; i < (7 - difference); i++ ) msg.buf[difference + i + 1] = padding_value;
-    if ( !config.flags.usePadding && difference < 7 ) msg.len = difference + 1;
-    _isotp_busToWrite->write(msg);
-
-#if defined(TEENSYDUINO) // Teensy
-    delay(constrain(config.separation_time, 0, 127));
-#elif defined(ARDUINO_ARCH_ESP32) //ESP32
-    vTaskDelay(constrain(config.separation_time, 0, 127));
-#endif
-
+    memmove(&msg.buf[2], &_tx.buf[0], 6);
+    if ( !_isotp_busToWrite->write(msg) ) return 0;
+    _tx.sent = 6;
+    return 1;
   }
+  int difference = constrain((size - _tx.sent), 1, 7); /* consecutive frame */
+  msg.len = 8;
+  msg.buf[0] = (2U << 4) | (_tx.counter & 0xF);
+  memmove(&msg.buf[1], &_tx.buf[_tx.sent], difference);
+  for ( int i = 0; i < (7 - difference); i++ ) msg.buf[difference + i + 1] = padding_value;
+  if ( !_tx.config.flags.usePadding && difference < 7 ) msg.len = difference + 1;
+  if ( !_isotp_busToWrite->write(msg) ) return 0;
+  _tx.sent += difference;
+  _tx.counter++;
+  return 1;
 }
 
 
@@ -114,8 +207,10 @@ ISOTP_FUNC void ISOTP_OPT::_process_frame_data(const CAN_message_t &msg) {
 #if defined(TEENSYDUINO)
   if ( msg.bus != readBus ) return;
 #endif
+  if ( readIdSet && (msg.id != readId || msg.flags.extended != readExtended) ) return;
 
   if ( msg.buf[0] <= 7 ) { /* single frame */
+    if ( msg.buf[0] >= msg.len ) return; /* shorter than its own length byte says */
     ISOTP_data config;
     config.id = msg.id;
     config.len = msg.buf[0];
@@ -123,39 +218,87 @@ ISOTP_FUNC void ISOTP_OPT::_process_frame_data(const CAN_message_t &msg) {
     if ( _ISOTP_OBJ->_isotp_handler ) _ISOTP_OBJ->_isotp_handler(config, msg.buf + 1);
   }
 
+  if ( (msg.buf[0] >> 4) == 3 ) { /* flow control for the transfer in flight */
+    if ( _tx.state == TX_WAIT_FC && msg.id == _tx.config.flow_control_id && msg.flags.extended == _tx.config.flags.extended ) {
+      _tx.fc[0] = msg.buf[0];
+      _tx.fc[1] = msg.buf[1];
+      _tx.fc[2] = msg.buf[2];
+      _tx.fc_pending = 1;
+    }
+    return;
+  }
+
   if ( (msg.buf[0] >> 4) == 1 ) { /* first frame */
-    if ( (((((uint16_t)msg.buf[0] & 0xF) << 8) | msg.buf[1]) + 9) >= (int)_max_length ) return; /* ISOTP message too large for local buffer */
-    uint8_t data[_max_length] = { (uint8_t)(msg.id >> 24), (uint8_t)(msg.id >> 16), (uint8_t)(msg.id >> 8), (uint8_t)msg.id, 0, 6, 0 };
-    memmove(data + 7, &msg.buf[0], 8); /* ID, ID, ID, ID, QPOS, QPOS, SEQUENCE: TOTAL 7 */
-    _rx_slots.findRemove(data, sizeof(data), 0, 1, 2, 3, 3);
-    _rx_slots.push_back(data, sizeof(data));
+    uint16_t len = (((uint16_t)msg.buf[0] & 0xF) << 8) | msg.buf[1];
+    if ( msg.len < 8 || len < 8 ) return; /* a first frame is always full, and anything under 8 bytes is a single frame (ISO 15765-2) */
+    if ( len > _max_length ) return; /* ISOTP message too large for local buffer */
+    int slot = _claim_rx_slot(msg);
+    uint16_t first = min(len, (uint16_t)6);
+    _rx_slots[slot].len = len;
+    _rx_slots[slot].pos = first;
+    _rx_slots[slot].sequence = 0;
+    _rx_slots[slot].last_frame = millis();
+    memmove(_rx_slots[slot].data, &msg.buf[2], first);
+    return;
   } /* first frame */
 
   if ( (msg.buf[0] >> 4) == 2 ) { /* consecutive frames */
-    uint8_t data[_max_length] = { (uint8_t)(msg.id >> 24), (uint8_t)(msg.id >> 16), (uint8_t)(msg.id >> 8), (uint8_t)msg.id };
-    if ( _rx_slots.find(data, sizeof(data), 0, 1, 2, 3, 3) ) {
-      int pos = ((((uint16_t)data[4] & 0xF) << 8) | data[5]);
-      data[4] = (pos + 7) >> 8;
-      data[5] = (pos + 7);
-      data[6] = (data[6] + 1) & 0xF; /* store only last 4 bits of sequence 0x0 -> 0xF */
-      if ( (msg.buf[0] & 0xF) != data[6] ) { /* sequence match fail */
-        _rx_slots.findRemove(data, sizeof(data), 0, 1, 2, 3, 3);
-        return;
+    int slot = _find_rx_slot(msg);
+    if ( slot < 0 ) return;
+    if ( (msg.buf[0] & 0xF) != ((_rx_slots[slot].sequence + 1) & 0xF) || millis() - _rx_slots[slot].last_frame > N_CR_TIMEOUT ) { /* sequence match fail or N_Cr timeout */
+      _rx_slots[slot].used = 0;
+      return;
+    }
+    uint16_t difference = min(_rx_slots[slot].len - _rx_slots[slot].pos, 7);
+    if ( msg.len < 1 + difference ) { /* only the last one may be short, and not shorter than what is left */
+      _rx_slots[slot].used = 0;
+      return;
+    }
+    _rx_slots[slot].sequence = msg.buf[0] & 0xF;
+    _rx_slots[slot].last_frame = millis();
+    memmove(_rx_slots[slot].data + _rx_slots[slot].pos, &msg.buf[1], difference);
+    _rx_slots[slot].pos += difference;
+    if ( _rx_slots[slot].pos >= _rx_slots[slot].len ) {
+      _rx_slots[slot].used = 0;
+      ISOTP_data config;
+      config.id = msg.id;
+      config.len = _rx_slots[slot].len;
+      config.flags.extended = msg.flags.extended;
+      if ( _ISOTP_OBJ->_isotp_handler ) _ISOTP_OBJ->_isotp_handler(config, _rx_slots[slot].data);
+      if ( ext_isotp_output1 ) ext_isotp_output1(config, _rx_slots[slot].data);
+    }
+  } /* consecutive frames */
+}
+
+
+ISOTP_FUNC int ISOTP_OPT::_find_rx_slot(const CAN_message_t &msg) {
+  for ( uint16_t i = 0; i < _rxBanks; i++ ) {
+    if ( _rx_slots[i].used && _rx_slots[i].id == msg.id && _rx_slots[i].bus == msg.bus && _rx_slots[i].extended == msg.flags.extended ) return i;
+  }
+  return -1;
+}
+
+
+ISOTP_FUNC int ISOTP_OPT::_claim_rx_slot(const CAN_message_t &msg) { /* a new first frame restarts the sender's session */
+  int slot = _find_rx_slot(msg);
+  if ( slot < 0 ) { /* a free slot, or else the one that went quiet the longest */
+    uint32_t now = millis(), oldest = 0;
+    for ( uint16_t i = 0; i < _rxBanks; i++ ) {
+      if ( !_rx_slots[i].used ) {
+        slot = i;
+        break;
       }
-      data[6] = msg.buf[0] & 0xF;
-      memmove(data + 9 + pos, &msg.buf[1], 7);
-      _rx_slots.replace(data, sizeof(data), 0, 1, 2, 3, 3);
-      if ( (((((uint16_t)data[7] & 0xF) << 8) | data[8]) - pos) <= 7 ) {
-        _rx_slots.findRemove(data, sizeof(data), 0, 1, 2, 3, 3);
-        ISOTP_data config;
-        config.id = ((uint32_t)(data[0] << 24) | data[1] << 16 | data[2] << 8 | data[3]);
-        config.len = ((((uint16_t)data[7] & 0xF) << 8) | data[8]);
-        config.flags.extended = msg.flags.extended;
-        if ( _ISOTP_OBJ->_isotp_handler ) _ISOTP_OBJ->_isotp_handler(config, data + 9);
-        if ( ext_isotp_output1 ) ext_isotp_output1(config, data + 9);
+      if ( now - _rx_slots[i].last_frame >= oldest ) {
+        oldest = now - _rx_slots[i].last_frame;
+        slot = i;
       }
     }
-  } /* consecutive frames */
+  }
+  _rx_slots[slot].id = msg.id;
+  _rx_slots[slot].bus = msg.bus;
+  _rx_slots[slot].extended = msg.flags.extended;
+  _rx_slots[slot].used = 1;
+  return slot;
 }
 
 
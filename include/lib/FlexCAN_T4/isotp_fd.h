@@ -0,0 +1,127 @@
+/*
+  MIT License
+
+  Copyright (c) 2018 Antonio Alexander Brewer (tonton81) - https://github.com/tonton81
+
+  Designed and tested for PJRC Teensy 4.0.
+
+  Forum link : https://forum.pjrc.com/threads/56035-isotp-FlexCAN-for-Teensy-4?highlight=isotp
+
+  Thanks goes to skpang, mjs513, and collin for tech/testing support
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#if !defined(_ISOTP_FD_H_)
+#define _ISOTP_FD_H_
+
+#include "Arduino.h"
+#include "isotp_types.h"
+#include "FlexCAN_T4.h"
+
+/* ISO 15765-2:2016 transport over CAN FD. Frames are as long as the first transmit mailbox
+   (up to 64 bytes), single frames carry up to 62 bytes, first frames 62 (58 with the 32-bit
+   length escape used above 4095 bytes) and consecutive frames 63. Short frames are padded up
+   to the next length FD can encode. Works on FlexCAN_T4FD only and uses the ext_outputFD2 hook,
+   so it can run next to isotp on a CAN2.0 bus. */
+
+#define ISOTPFD_CLASS template<ISOTP_RXBANKS_TABLE _rxBanks = RX_BANKS_4, size_t _max_length = 4096>
+#define ISOTPFD_FUNC template<ISOTP_RXBANKS_TABLE _rxBanks, size_t _max_length>
+#define ISOTPFD_OPT isotp_fd<_rxBanks, _max_length>
+
+static FlexCAN_T4_Base* _isotp_fd_busToWrite = nullptr;
+
+class isotp_fd_Base {
+  public:
+    virtual void _process_frame_data(const CANFD_message_t &msg) = 0;
+    virtual void write(const ISOTP_data &config, const uint8_t *buf, uint32_t size) = 0;
+    _isotp_cb_ptr _isotp_handler = nullptr;
+};
+
+static isotp_fd_Base* _ISOTP_FD_OBJ = nullptr;
+
+ISOTPFD_CLASS class isotp_fd : public isotp_fd_Base {
+  public:
+    isotp_fd() { _ISOTP_FD_OBJ = this; }
+    void setWriteBus(FlexCAN_T4_Base* _busWritePtr) {
+      _isotp_fd_busToWrite = _busWritePtr;
+      readBus = _busWritePtr->getBusNumber();
+    }
+    void begin() { enable(); }
+    void enable(bool yes = 1) { isotp_enabled = yes; }
+    void setPadding(uint8_t _byte) { padding_value = _byte; }
+    void onReceive(_isotp_cb_ptr handler) { _ISOTP_FD_OBJ->_isotp_handler = handler; }
+    void write(const ISOTP_data &config, const uint8_t *buf, uint32_t size);
+    void write(const ISOTP_data &config, const char *buf, uint32_t size) { write(config, (const uint8_t*)buf, size); }
+    bool writeAsync(const ISOTP_data &config, const uint8_t *buf, uint32_t size, _isotp_tx_cb_ptr done = nullptr); /* buf must stay valid until done is called */
+    bool writeBusy() { return _tx.state != TX_IDLE; }
+    void cancelWrite();
+    void events(); /* call from loop(), sends the frames queued by writeAsync */
+    void sendFlowControl(const ISOTP_data &config);
+
+  private:
+    void _process_frame_data(const CANFD_message_t &msg);
+    bool _send_next_frame();
+    void _process_flow_control();
+    void _finish_write(ISOTP_TX_STATUS status);
+    void _pad(CANFD_message_t &msg, uint8_t used);
+    static uint32_t _stmin_to_us(uint8_t stmin);
+    static uint8_t _fd_length(uint8_t len);
+    static const uint32_t N_BS_TIMEOUT = 1000; /* ms to wait for flow control */
+    enum { TX_IDLE, TX_SEND, TX_WAIT_FC };
+    struct {
+      ISOTP_data config;
+      const uint8_t *buf = nullptr;
+      uint32_t size = 0;
+      uint32_t sent = 0;                   /* payload bytes already written */
+      uint8_t frame_len = 64;              /* TX_DL, bytes per frame */
+      uint8_t counter = 1;                 /* sequence number of the next consecutive frame */
+      uint32_t separation_us = 0;          /* ours, the peer's STmin is never undercut */
+      uint32_t peer_separation_us = 0;
+      uint8_t block_size = 0;              /* frames per flow control, 0: no more flow control */
+      uint8_t block_left = 0;
+      uint32_t last_frame = 0;             /* micros() when the last frame was written */
+      uint32_t fc_wait_start = 0;          /* millis() */
+      volatile uint8_t fc[3];              /* latest flow control frame from the interrupt */
+      volatile bool fc_pending = 0;
+      _isotp_tx_cb_ptr done = nullptr;
+      volatile uint8_t state = TX_IDLE;
+    } _tx;
+    static const uint32_t N_CR_TIMEOUT = 1000; /* ms between consecutive frames before a reassembly is dropped */
+    struct {
+      uint32_t id = 0;
+      uint8_t bus = 0;
+      bool extended = 0;
+      bool used = 0;
+      uint8_t sequence = 0;                /* of the last consecutive frame received */
+      uint8_t rx_dl = 0;                   /* first frame's length, every consecutive frame but the last has it */
+      uint32_t len = 0;                    /* total payload from the first frame */
+      uint32_t pos = 0;                    /* payload bytes received so far */
+      uint32_t last_frame = 0;             /* millis() */
+      uint8_t data[_max_length];
+    } _rx_slots[_rxBanks];
+    int _find_rx_slot(const CANFD_message_t &msg);
+    int _claim_rx_slot(const CANFD_message_t &msg);
+    uint8_t padding_value = 0xCC; /* what ISO 15765-2 recommends for FD padding */
+    volatile bool isotp_enabled = 0;
+    uint8_t readBus = 1;
+};
+
+#include "isotp_fd.tpp"
+#endif
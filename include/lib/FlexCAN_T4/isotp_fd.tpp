@@ -0,0 +1,335 @@
+/*
+  MIT License
+
+  Copyright (c) 2018 Antonio Alexander Brewer (tonton81) - https://github.com/tonton81
+
+  Designed and tested for PJRC Teensy 4.0.
+
+  Forum link : https://forum.pjrc.com/threads/56035-FlexCAN_T4-FlexCAN-for-Teensy-4?highlight=flexcan_t4
+
+  Thanks goes to skpang, mjs513, and collin for tech/testing support
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#include <isotp_fd.h>
+#include "Arduino.h"
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::sendFlowControl(const ISOTP_data &config) {
+  CANFD_message_t msg;
+  msg.id = config.id;
+  msg.len = 8;
+  msg.flags.extended = config.flags.extended;
+  msg.buf[0] = (3U << 4) | constrain(config.flow_control_type, 0, 2);
+  msg.buf[1] = config.blockSize;
+  uint16_t separation_time = config.separation_time;
+  if ( config.flags.separation_uS ) {
+    separation_time = constrain(((config.separation_time + 50) / 100 * 100), 100, 900);
+    separation_time = map(separation_time, 100, 900, 0xF1, 0xF9);
+  }
+  else {
+    separation_time = constrain(separation_time, 0, 127);
+  }
+  msg.buf[2] = separation_time;
+  for ( int i = 3; i < 8; i++ ) msg.buf[i] = padding_value;
+  _isotp_fd_busToWrite->write(msg);
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::write(const ISOTP_data &config, const uint8_t *buf, uint32_t size) { /* blocking, buf may go out of scope after return */
+  while ( writeBusy() ) events();
+  if ( !writeAsync(config, buf, size) ) return;
+  while ( writeBusy() ) events();
+}
+
+
+ISOTPFD_FUNC bool ISOTPFD_OPT::writeAsync(const ISOTP_data &config, const uint8_t *buf, uint32_t size, _isotp_tx_cb_ptr done) {
+  if ( writeBusy() || !size ) return 0;
+  _tx.config = config;
+  if ( !_tx.config.flow_control_id ) _tx.config.flow_control_id = config.id;
+  _tx.buf = buf;
+  _tx.size = size;
+  _tx.sent = 0;
+  _tx.frame_len = _fd_length(constrain(_isotp_fd_busToWrite->getFirstTxBoxSize(), 8, 64)); /* TX_DL follows the mailbox region size */
+  _tx.counter = 1;
+  if ( config.flags.separation_uS ) _tx.separation_us = constrain(config.separation_time, 100, 900);
+  else _tx.separation_us = constrain(config.separation_time, 0, 127) * 1000;
+  _tx.peer_separation_us = 0;
+  _tx.block_size = _tx.block_left = 0;
+  _tx.fc_pending = 0;
+  _tx.done = done;
+  _tx.state = TX_SEND;
+  return 1;
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::cancelWrite() {
+  if ( writeBusy() ) _finish_write(ISOTP_TX_CANCELLED);
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::_finish_write(ISOTP_TX_STATUS status) {
+  _tx.state = TX_IDLE;
+  if ( _tx.done ) _tx.done(_tx.config, status);
+}
+
+
+ISOTPFD_FUNC uint32_t ISOTPFD_OPT::_stmin_to_us(uint8_t stmin) {
+  if ( stmin <= 0x7F ) return stmin * 1000;
+  if ( stmin >= 0xF1 && stmin <= 0xF9 ) return (stmin - 0xF0) * 100;
+  return 127000; /* reserved values, use the longest STmin */
+}
+
+
+ISOTPFD_FUNC uint8_t ISOTPFD_OPT::_fd_length(uint8_t len) { /* smallest frame length FD can encode that holds len bytes */
+  if ( len <= 8 ) return len;
+  if ( len <= 24 ) return (len + 3) & ~3;
+  if ( len <= 32 ) return 32;
+  if ( len <= 48 ) return 48;
+  return 64;
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::_pad(CANFD_message_t &msg, uint8_t used) {
+  msg.len = _fd_length(used);
+  if ( _tx.config.flags.usePadding && msg.len < 8 ) msg.len = 8;
+  for ( int i = used; i < msg.len; i++ ) msg.buf[i] = padding_value;
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::_process_flow_control() {
+  uint8_t fc[3];
+  noInterrupts();
+  fc[0] = _tx.fc[0]; fc[1] = _tx.fc[1]; fc[2] = _tx.fc[2];
+  _tx.fc_pending = 0;
+  interrupts();
+
+  if ( (fc[0] & 0xF) == 0 ) { /* clear to send */
+    _tx.block_size = _tx.block_left = fc[1];
+    _tx.peer_separation_us = _stmin_to_us(fc[2]);
+    _tx.state = TX_SEND;
+  }
+  else if ( (fc[0] & 0xF) == 1 ) _tx.fc_wait_start = millis(); /* wait, N_Bs starts over */
+  else _finish_write(ISOTP_TX_OVERFLOW); /* overflow/abort */
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::events() {
+  while ( writeBusy() ) {
+    if ( _tx.state == TX_WAIT_FC ) {
+      if ( _tx.fc_pending ) _process_flow_control();
+      else if ( millis() - _tx.fc_wait_start >= N_BS_TIMEOUT ) _finish_write(ISOTP_TX_TIMEOUT);
+      if ( _tx.state != TX_SEND ) return;
+    }
+    uint32_t separation_us = max(_tx.separation_us, _tx.peer_separation_us);
+    if ( _tx.sent && (micros() - _tx.last_frame) < separation_us ) return; /* STmin not over yet */
+    if ( !_isotp_fd_busToWrite->freeTxMailboxes() ) return; /* don't fill the queue other senders need */
+    bool ends_block = !_tx.sent || (_tx.block_size && _tx.block_left == 1); /* the peer tells us how to go on */
+    if ( ends_block ) { /* before the write, its flow control can arrive before write() returns */
+      _tx.fc_wait_start = millis();
+      _tx.state = TX_WAIT_FC;
+    }
+    if ( !_send_next_frame() ) { /* bus refused it, try again on the next call */
+      if ( ends_block ) {
+        _tx.state = TX_SEND;
+        _tx.fc_pending = 0;
+      }
+      return;
+    }
+    _tx.last_frame = micros();
+    if ( _tx.sent >= _tx.size ) { /* a single frame or the last one, no flow control follows */
+      _finish_write(ISOTP_TX_DONE);
+      return;
+    }
+    if ( ends_block ) return;
+    if ( _tx.block_size ) _tx.block_left--;
+    if ( separation_us ) return; /* one frame per call when paced */
+  }
+}
+
+
+ISOTPFD_FUNC bool ISOTPFD_OPT::_send_next_frame() {
+  CANFD_message_t msg;
+  msg.id = _tx.config.id;
+  msg.flags.extended = _tx.config.flags.extended;
+  uint32_t size = _tx.size;
+  uint8_t frame_len = _tx.frame_len;
+  if ( size <= 7 ) { /* single frame, classic header */
+    msg.buf[0] = size;
+    memmove(&msg.buf[1], &_tx.buf[0], size);
+    _pad(msg, size + 1);
+    if ( !_isotp_fd_busToWrite->write(msg) ) return 0;
+    _tx.sent = size;
+    return 1;
+  }
+  if ( frame_len > 8 && size <= (uint32_t)frame_len - 2 ) { /* single frame, escaped length */
+    msg.buf[0] = 0;
+    msg.buf[1] = size;
+    memmove(&msg.buf[2], &_tx.buf[0], size);
+    _pad(msg, size + 2);
+    if ( !_isotp_fd_busToWrite->write(msg) ) return 0;
+    _tx.sent = size;
+    return 1;
+  }
+  if ( !_tx.sent ) { /* first frame, always a full TX_DL so the peer learns it */
+    uint8_t header = 2;
+    if ( size <= 4095 ) {
+      msg.buf[0] = (1U << 4) | size >> 8;
+      msg.buf[1] = (uint8_t)size;
+    }
+    else { /* 32-bit length escape */
+      msg.buf[0] = (1U << 4);
+      msg.buf[1] = 0;
+      msg.buf[2] = size >> 24;
+      msg.buf[3] = size >> 16;
+      msg.buf[4] = size >> 8;
+      msg.buf[5] = size;
+      header = 6;
+    }
+    memmove(&msg.buf[header], &_tx.buf[0], frame_len - header);
+    msg.len = frame_len;
+    if ( !_isotp_fd_busToWrite->write(msg) ) return 0;
+    _tx.sent = frame_len - header;
+    return 1;
+  }
+  uint32_t difference = min(size - _tx.sent, (uint32_t)frame_len - 1); /* consecutive frame */
+  msg.buf[0] = (2U << 4) | (_tx.counter & 0xF);
+  memmove(&msg.buf[1], &_tx.buf[_tx.sent], difference);
+  _pad(msg, difference + 1);
+  if ( !_isotp_fd_busToWrite->write(msg) ) return 0;
+  _tx.sent += difference;
+  _tx.counter++;
+  return 1;
+}
+
+
+ISOTPFD_FUNC void ISOTPFD_OPT::_process_frame_data(const CANFD_message_t &msg) {
+  if ( !isotp_enabled ) return;
+  if ( msg.bus != readBus || !msg.len ) return;
+
+  if ( (msg.buf[0] >> 4) == 0 ) { /* single frame */
+    ISOTP_data config;
+    const uint8_t *data = msg.buf + 1;
+    config.len = msg.buf[0] & 0xF;
+    if ( !config.len && msg.len > 8 ) { /* escaped length */
+      config.len = msg.buf[1];
+      data = msg.buf + 2;
+    }
+    if ( !config.len || data + config.len > msg.buf + msg.len ) return;
+    config.id = msg.id;
+    config.flags.extended = msg.flags.extended;
+    if ( _ISOTP_FD_OBJ->_isotp_handler ) _ISOTP_FD_OBJ->_isotp_handler(config, data);
+    return;
+  }
+
+  if ( (msg.buf[0] >> 4) == 3 ) { /* flow control for the transfer in flight */
+    if ( _tx.state == TX_WAIT_FC && msg.id == _tx.config.flow_control_id && msg.flags.extended == _tx.config.flags.extended ) {
+      _tx.fc[0] = msg.buf[0];
+      _tx.fc[1] = msg.buf[1];
+      _tx.fc[2] = msg.buf[2];
+      _tx.fc_pending = 1;
+    }
+    return;
+  }
+
+  if ( (msg.buf[0] >> 4) == 1 ) { /* first frame */
+    uint32_t len = (((uint32_t)msg.buf[0] & 0xF) << 8) | msg.buf[1];
+    uint8_t header = 2;
+    if ( !len ) { /* 32-bit length escape */
+      len = ((uint32_t)msg.buf[2] << 24) | ((uint32_t)msg.buf[3] << 16) | ((uint32_t)msg.buf[4] << 8) | msg.buf[5];
+      header = 6;
+    }
+    if ( len > _max_length ) return; /* ISOTP message too large for local buffer */
+    if ( msg.len < 8 ) return; /* RX_DL is at least 8, and a first frame is always full */
+    int slot = _claim_rx_slot(msg);
+    uint32_t first = min(len, (uint32_t)msg.len - header);
+    _rx_slots[slot].rx_dl = msg.len;
+    _rx_slots[slot].len = len;
+    _rx_slots[slot].pos = first;
+    _rx_slots[slot].sequence = 0;
+    _rx_slots[slot].last_frame = millis();
+    memmove(_rx_slots[slot].data, &msg.buf[header], first);
+    return;
+  }
+
+  if ( (msg.buf[0] >> 4) == 2 ) { /* consecutive frames */
+    int slot = _find_rx_slot(msg);
+    if ( slot < 0 ) return;
+    if ( (msg.buf[0] & 0xF) != ((_rx_slots[slot].sequence + 1) & 0xF) || millis() - _rx_slots[slot].last_frame > N_CR_TIMEOUT ) { /* sequence match fail or N_Cr timeout */
+      _rx_slots[slot].used = 0;
+      return;
+    }
+    uint32_t left = _rx_slots[slot].len - _rx_slots[slot].pos;
+    bool last = left <= (uint32_t)_rx_slots[slot].rx_dl - 1;
+    if ( last ? msg.len < 1 + left : msg.len != _rx_slots[slot].rx_dl ) { /* only the last one may be shorter than RX_DL, and not shorter than what is left */
+      _rx_slots[slot].used = 0;
+      return;
+    }
+    _rx_slots[slot].sequence = msg.buf[0] & 0xF;
+    _rx_slots[slot].last_frame = millis();
+    uint32_t difference = min(left, (uint32_t)msg.len - 1);
+    memmove(_rx_slots[slot].data + _rx_slots[slot].pos, &msg.buf[1], difference);
+    _rx_slots[slot].pos += difference;
+    if ( _rx_slots[slot].pos >= _rx_slots[slot].len ) {
+      _rx_slots[slot].used = 0;
+      ISOTP_data config;
+      config.id = msg.id;
+      config.len = _rx_slots[slot].len;
+      config.flags.extended = msg.flags.extended;
+      if ( _ISOTP_FD_OBJ->_isotp_handler ) _ISOTP_FD_OBJ->_isotp_handler(config, _rx_slots[slot].data);
+    }
+  } /* consecutive frames */
+}
+
+
+ISOTPFD_FUNC int ISOTPFD_OPT::_find_rx_slot(const CANFD_message_t &msg) {
+  for ( uint16_t i = 0; i < _rxBanks; i++ ) {
+    if ( _rx_slots[i].used && _rx_slots[i].id == msg.id && _rx_slots[i].bus == msg.bus && _rx_slots[i].extended == msg.flags.extended ) return i;
+  }
+  return -1;
+}
+
+
+ISOTPFD_FUNC int ISOTPFD_OPT::_claim_rx_slot(const CANFD_message_t &msg) { /* a new first frame restarts the sender's session */
+  int slot = _find_rx_slot(msg);
+  if ( slot < 0 ) { /* a free slot, or else the one that went quiet the longest */
+    uint32_t now = millis(), oldest = 0;
+    for ( uint16_t i = 0; i < _rxBanks; i++ ) {
+      if ( !_rx_slots[i].used ) {
+        slot = i;
+        break;
+      }
+      if ( now - _rx_slots[i].last_frame >= oldest ) {
+        oldest = now - _rx_slots[i].last_frame;
+        slot = i;
+      }
+    }
+  }
+  _rx_slots[slot].id = msg.id;
+  _rx_slots[slot].bus = msg.bus;
+  _rx_slots[slot].extended = msg.flags.extended;
+  _rx_slots[slot].used = 1;
+  return slot;
+}
+
+
+void ext_outputFD2(const CANFD_message_t &msg) {
+  _ISOTP_FD_OBJ->_process_frame_data(msg);
+}
@@ -41,9 +41,9 @@ typedef enum ISOTP_ID_TYPE {
   EXTENDED_ID = 1,
 } ISOTP_ID_TYPE;
 
-#define ISOTPSERVER_CLASS template<uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request, uint8_t *buffer, uint16_t len>
-#define ISOTPSERVER_FUNC template<uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request, uint8_t *buffer, uint16_t len>
-#define ISOTPSERVER_OPT isotp_server<canid, extended, request, buffer, len>
+#define ISOTPSERVER_CLASS template<uint8_t _entries = 16>
+#define ISOTPSERVER_FUNC template<uint8_t _entries>
+#define ISOTPSERVER_OPT isotp_server<_entries>
 
 
 class isotp_server_Base {
@@ -51,10 +51,18 @@ class isotp_server_Base {
     virtual void _process_frame_data(const CAN_message_t &msg) = 0;
     static int buffer_hosts;
     FlexCAN_T4_Base* _isotp_server_busToWrite = nullptr;
+    uint8_t readBus = 1;
 };
 
-static isotp_server_Base* _ISOTPSERVER_OBJ[16] = { nullptr };
+static isotp_server_Base* _ISOTPSERVER_OBJ[4] = { nullptr }; /* one server per bus */
 
+/*
+  Serves any number of buffers (up to _entries) on one bus. Each buffer is registered at runtime under
+  a CAN ID and a request of 1 to 4 bytes, compared with the start of the incoming frame (PCI byte included).
+  Requests and flow control frames are looked up in hash tables, so the interrupt does the same work per
+  frame however many buffers are registered. Only one transfer per CAN ID runs at a time, a new request
+  on the same ID restarts it.
+*/
 ISOTPSERVER_CLASS class isotp_server : public isotp_server_Base {
   public:
     isotp_server();
@@ -62,29 +70,66 @@ ISOTPSERVER_CLASS class isotp_server : public isotp_server_Base {
     void enable(bool yes = 1) { isotp_enabled = yes; }
     void setWriteBus(FlexCAN_T4_Base* _busWritePtr) { 
        _isotp_server_busToWrite = _busWritePtr; 
-      #if defined(__IMXRT1062__)
-        if ( _isotp_server_busToWrite == _CAN1 ) readBus = 1;    
-        if ( _isotp_server_busToWrite == _CAN2 ) readBus = 2;
-        if ( _isotp_server_busToWrite == _CAN3 ) readBus = 3;
-      #endif
-      #if defined(__MK20DX256__) || defined(__MK64FX512__) || defined(__MK66FX1M0__)
-        if ( _isotp_server_busToWrite == _CAN0 ) readBus = 0;    
-        if ( _isotp_server_busToWrite == _CAN1 ) readBus = 1;
-      #endif
+      readBus = _busWritePtr->getBusNumber(); /* _CANx are per translation unit, ask the controller */
     }   
     void setPadding(uint8_t _byte) { padding_value = _byte; }
+    bool addBuffer(uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request, const uint8_t *buffer, uint16_t len); /* buffer is read while it is sent, keep it valid */
+    bool removeBuffer(uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request);
+    void events(); /* call from loop(), the interrupt only records requests and flow control */
 
   private:
     void _process_frame_data(const CAN_message_t &msg);
-    void send_first_frame();
-    bool send_next_frame();
-    uint8_t header[2] = { 0 };
-    volatile uint8_t request_size = 4;
-    volatile uint16_t index_pos = 0;
-    volatile uint8_t index_sequence = 1;
+    static const uint32_t N_BS_TIMEOUT = 1000; /* ms to wait for flow control */
+    static const uint16_t TABLE_SIZE = _entries * 2; /* hash tables stay at most half full */
+    static const uint8_t EMPTY = 0xFF;
+    enum { SERVER_IDLE, SERVER_WAIT_FC, SERVER_SEND };
+
+    struct entry_t {
+      uint64_t key;
+      uint32_t request;
+      uint8_t request_size;
+      uint8_t channel;
+      const uint8_t *buffer;
+      uint16_t len;
+      bool used = 0;
+    } entries[_entries];
+
+    struct channel_t {                     /* transmit state of one CAN ID */
+      uint64_t key;
+      uint32_t id;
+      bool extended;
+      uint8_t users = 0;                   /* entries on this ID, 0: slot free */
+      volatile uint8_t request_pending = EMPTY; /* entry requested from the interrupt */
+      volatile bool fc_pending = 0;
+      volatile uint8_t fc[3];              /* latest flow control frame from the interrupt */
+      volatile uint8_t state = SERVER_IDLE;
+      uint8_t entry = 0;                   /* being sent */
+      uint8_t block_size = 0;              /* frames per flow control, 0: no more flow control */
+      uint8_t block_left = 0;
+      uint32_t separation_us = 0;
+      uint32_t last_frame = 0;             /* micros() */
+      uint32_t fc_wait_start = 0;          /* millis() */
+      uint16_t index_pos = 0;
+      uint8_t index_sequence = 1;
+    } channels[_entries];
+
+    uint8_t request_table[TABLE_SIZE];     /* entry index by (id, request), EMPTY if unused */
+    uint8_t channel_table[TABLE_SIZE];     /* channel index by id */
+    uint8_t request_sizes = 0;             /* bit n set: some request is n + 1 bytes long */
+
+    static uint64_t request_key(uint32_t canid, bool extended, uint32_t request, uint8_t request_size);
+    static uint64_t channel_key(uint32_t canid, bool extended) { return canid | ((uint64_t)extended << 29); }
+    static uint16_t hash(uint64_t key) { return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) % TABLE_SIZE; }
+    int find_request(uint64_t key);
+    int find_channel(uint64_t key);
+    void rebuild_tables();
+    void process_flow_control(channel_t &channel);
+    bool send_first_frame(channel_t &channel);
+    bool send_next_frame(channel_t &channel);
+    void run_channel(channel_t &channel);
+
     volatile bool isotp_enabled = 0;
     uint8_t padding_value = 0xA5;
-    uint8_t readBus = 1;
 };
 
 
@@ -37,111 +37,273 @@ int isotp_server_Base::buffer_hosts = 0;
 
 
 ISOTPSERVER_FUNC ISOTPSERVER_OPT::isotp_server() {
-  _ISOTPSERVER_OBJ[isotp_server_Base::buffer_hosts] = this;
-  isotp_server_Base::buffer_hosts++; 
-  for ( int i = 3; i > -1; i-- ) {
-    if ( ((request >> (i * 8)) & 0xFF) ) break;
-    request_size--;
+  if ( isotp_server_Base::buffer_hosts < 4 ) _ISOTPSERVER_OBJ[isotp_server_Base::buffer_hosts++] = this;
+  memset(request_table, EMPTY, sizeof(request_table));
+  memset(channel_table, EMPTY, sizeof(channel_table));
+}
+
+
+ISOTPSERVER_FUNC uint64_t ISOTPSERVER_OPT::request_key(uint32_t canid, bool extended, uint32_t request, uint8_t request_size) {
+  if ( request_size < 4 ) request &= (1UL << (request_size * 8)) - 1;
+  return channel_key(canid, extended) | ((uint64_t)(request_size - 1) << 30) | ((uint64_t)request << 32);
+}
+
+
+ISOTPSERVER_FUNC int ISOTPSERVER_OPT::find_request(uint64_t key) {
+  for ( uint16_t i = hash(key), probes = 0; probes < TABLE_SIZE; i = (i + 1) % TABLE_SIZE, probes++ ) {
+    if ( request_table[i] == EMPTY ) return -1;
+    if ( entries[request_table[i]].key == key ) return request_table[i];
+  }
+  return -1;
+}
+
+
+ISOTPSERVER_FUNC int ISOTPSERVER_OPT::find_channel(uint64_t key) {
+  for ( uint16_t i = hash(key), probes = 0; probes < TABLE_SIZE; i = (i + 1) % TABLE_SIZE, probes++ ) {
+    if ( channel_table[i] == EMPTY ) return -1;
+    if ( channels[channel_table[i]].key == key ) return channel_table[i];
   }
-  header[0] = (1U << 4) | len >> 8;
-  header[1] = (uint8_t)len;
+  return -1;
 }
 
 
-ISOTPSERVER_FUNC void ISOTPSERVER_OPT::send_first_frame() {
-  index_sequence = 1;
+ISOTPSERVER_FUNC void ISOTPSERVER_OPT::rebuild_tables() { /* call with interrupts off */
+  memset(request_table, EMPTY, sizeof(request_table));
+  memset(channel_table, EMPTY, sizeof(channel_table));
+  request_sizes = 0;
+  for ( uint8_t i = 0; i < _entries; i++ ) {
+    if ( entries[i].used ) {
+      uint16_t slot = hash(entries[i].key);
+      while ( request_table[slot] != EMPTY ) slot = (slot + 1) % TABLE_SIZE;
+      request_table[slot] = i;
+      request_sizes |= 1U << (entries[i].request_size - 1);
+    }
+    if ( channels[i].users ) {
+      uint16_t slot = hash(channels[i].key);
+      while ( channel_table[slot] != EMPTY ) slot = (slot + 1) % TABLE_SIZE;
+      channel_table[slot] = i;
+    }
+  }
+}
+
+
+ISOTPSERVER_FUNC bool ISOTPSERVER_OPT::addBuffer(uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request, const uint8_t *buffer, uint16_t len) {
+  uint8_t request_size = 4;
+  while ( request_size && !((request >> ((request_size - 1) * 8)) & 0xFF) ) request_size--;
+  if ( !request_size || !buffer || len > 4095 ) return 0;
+  uint64_t key = request_key(canid, extended, request, request_size);
+
+  int index = find_request(key);
+  if ( index >= 0 ) { /* same request again, swap the buffer */
+    noInterrupts();
+    entries[index].buffer = buffer;
+    entries[index].len = len;
+    channels[entries[index].channel].state = SERVER_IDLE;
+    interrupts();
+    return 1;
+  }
+
+  for ( index = 0; index < _entries && entries[index].used; index++ );
+  if ( index == _entries ) return 0; /* no room, raise _entries */
+
+  int channel = find_channel(channel_key(canid, extended));
+  if ( channel < 0 ) {
+    for ( channel = 0; channels[channel].users; channel++ ); /* never more channels than entries */
+    channels[channel].key = channel_key(canid, extended);
+    channels[channel].id = canid;
+    channels[channel].extended = extended;
+    channels[channel].request_pending = EMPTY;
+    channels[channel].state = SERVER_IDLE;
+  }
+
+  noInterrupts();
+  entries[index].key = key;
+  entries[index].request = request;
+  entries[index].request_size = request_size;
+  entries[index].channel = channel;
+  entries[index].buffer = buffer;
+  entries[index].len = len;
+  entries[index].used = 1;
+  channels[channel].users++;
+  rebuild_tables();
+  interrupts();
+  return 1;
+}
+
+
+ISOTPSERVER_FUNC bool ISOTPSERVER_OPT::removeBuffer(uint32_t canid, ISOTP_ID_TYPE extended, uint32_t request) {
+  uint8_t request_size = 4;
+  while ( request_size && !((request >> ((request_size - 1) * 8)) & 0xFF) ) request_size--;
+  if ( !request_size ) return 0;
+  int index = find_request(request_key(canid, extended, request, request_size));
+  if ( index < 0 ) return 0;
+
+  noInterrupts();
+  channel_t &channel = channels[entries[index].channel];
+  if ( channel.entry == index || channel.request_pending == index ) {
+    channel.state = SERVER_IDLE;
+    channel.request_pending = EMPTY;
+  }
+  channel.users--;
+  entries[index].used = 0;
+  rebuild_tables();
+  interrupts();
+  return 1;
+}
+
+
+ISOTPSERVER_FUNC bool ISOTPSERVER_OPT::send_first_frame(channel_t &channel) {
+  const entry_t &entry = entries[channel.entry];
   CAN_message_t msg;
-  msg.id = canid;
-  msg.flags.extended = extended;
-  if ( len <= 7 ) {
+  msg.id = channel.id;
+  msg.flags.extended = channel.extended;
+  if ( entry.len <= 7 ) {
     memset(&msg.buf[0], padding_value, 8);
-    msg.buf[0] = len;
-    memmove(&msg.buf[1], &buffer[0], len);
-    if ( _isotp_server_busToWrite ) _isotp_server_busToWrite->write(msg);
-    return;
+    msg.buf[0] = entry.len;
+    memmove(&msg.buf[1], &entry.buffer[0], entry.len);
+    return _isotp_server_busToWrite->write(msg);
   }
   msg.len = 8;
-  memmove(&msg.buf[0], &header[0], 2);
-  memmove(&msg.buf[2], &buffer[0], 6);
-  if ( _isotp_server_busToWrite ) _isotp_server_busToWrite->write(msg);
+  msg.buf[0] = (1U << 4) | entry.len >> 8;
+  msg.buf[1] = (uint8_t)entry.len;
+  memmove(&msg.buf[2], &entry.buffer[0], 6);
+  return _isotp_server_busToWrite->write(msg);
 }
 
 
-ISOTPSERVER_FUNC bool ISOTPSERVER_OPT::send_next_frame() {
-  if ( index_pos >= len ) return 0;
+ISOTPSERVER_FUNC bool ISOTPSERVER_OPT::send_next_frame(channel_t &channel) {
+  const entry_t &entry = entries[channel.entry];
+  uint16_t left = entry.len - channel.index_pos;
   CAN_message_t msg;
-  msg.id = canid;
-  msg.flags.extended = extended;
+  msg.id = channel.id;
+  msg.flags.extended = channel.extended;
   msg.len = 8;
-  msg.buf[0] = (2U << 4) | (index_sequence & 0xF);
-  memmove(&msg.buf[1], &buffer[index_pos], constrain((len - index_pos), 1, 7));
-  index_sequence++;
-  if ((len - index_pos) < 7) for ( int i = (len - index_pos + 1); i < 8; i++ ) msg.buf[i] = 0xA5; 
-  if ( _isotp_server_busToWrite ) _isotp_server_busToWrite->write(msg);
-  index_pos += 7;
+  msg.buf[0] = (2U << 4) | (channel.index_sequence & 0xF);
+  memmove(&msg.buf[1], &entry.buffer[channel.index_pos], constrain(left, 1, 7));
+  if ( left < 7 ) for ( int i = left + 1; i < 8; i++ ) msg.buf[i] = padding_value;
+  if ( !_isotp_server_busToWrite->write(msg) ) return 0;
+  channel.index_sequence++;
+  channel.index_pos += 7;
   return 1;
 }
 
 
-ISOTPSERVER_FUNC void ISOTPSERVER_OPT::_process_frame_data(const CAN_message_t &msg) {
-  if ( !isotp_enabled ) return;
-  
-  #if defined(TEENSYDUINO)
-    if ( msg.bus != readBus ) return;
-  #endif
+ISOTPSERVER_FUNC void ISOTPSERVER_OPT::process_flow_control(channel_t &channel) {
+  uint8_t flow[3];
+  noInterrupts();
+  flow[0] = channel.fc[0]; flow[1] = channel.fc[1]; flow[2] = channel.fc[2];
+  channel.fc_pending = 0;
+  interrupts();
 
-  if ( msg.id == canid ) {
-    CAN_message_t msgCopy = msg;
-    uint8_t request_array[4] = { (uint8_t)(request >> 24), (uint8_t)(request >> 16), (uint8_t)(request >> 8), (uint8_t)(request) };
-    memmove(&msgCopy.buf[0], &request_array[4 - request_size], request_size);
-    bool request_match = true;
-    for ( int i = 0; i < 4; i++ ) {
-      if ( msg.buf[i] != msgCopy.buf[i] ) {
-        request_match = false;
-        break;
-      }
-    }
-    if ( request_match ) {
-      send_first_frame();
-      index_pos = 6;
-      return;
-    }
-    if ( msg.buf[0] & (3U << 4) ) { /* flow control frame */
-      if ( !msg.buf[1] ) { /* block size */
-        bool sent = 1;
-        while ( sent ) {
-          sent = send_next_frame();
-          if ( msg.buf[2] < 128 ) delay(msg.buf[2]);
-          else if ( msg.buf[2] == constrain(msg.buf[2], 0xF1, 0xF9) ) {
-            delayMicroseconds(map(msg.buf[2], 0xF1, 0xF9, 100, 900));
-          }
-        }
-      }
-      else {
-        for ( int i = 0; i < msg.buf[1]; i++ ) {
-          send_next_frame();
-          if ( msg.buf[2] < 128 ) delay(msg.buf[2]);
-          else if ( msg.buf[2] == constrain(msg.buf[2], 0xF1, 0xF9) ) {
-            delayMicroseconds(map(msg.buf[2], 0xF1, 0xF9, 100, 900));
-          }
-        }
-      }
-    }
+  if ( (flow[0] & 0xF) == 0 ) { /* clear to send */
+    channel.block_size = channel.block_left = flow[1];
+    if ( flow[2] < 128 ) channel.separation_us = flow[2] * 1000;
+    else if ( flow[2] >= 0xF1 && flow[2] <= 0xF9 ) channel.separation_us = (flow[2] - 0xF0) * 100;
+    else channel.separation_us = 127000;
+    channel.state = SERVER_SEND;
   }
+  else if ( (flow[0] & 0xF) == 1 ) channel.fc_wait_start = millis(); /* wait, N_Bs starts over */
+  else channel.state = SERVER_IDLE; /* overflow/abort */
 }
 
 
-void ext_output3(const CAN_message_t &msg) {
-  for ( int i = 0; i < isotp_server_Base::buffer_hosts; i++ ) if ( _ISOTPSERVER_OBJ[i] ) _ISOTPSERVER_OBJ[i]->_process_frame_data(msg);
+ISOTPSERVER_FUNC void ISOTPSERVER_OPT::events() {
+  if ( !_isotp_server_busToWrite ) return;
+  for ( uint8_t i = 0; i < _entries; i++ ) {
+    if ( channels[i].users ) run_channel(channels[i]);
+  }
 }
 
 
+ISOTPSERVER_FUNC void ISOTPSERVER_OPT::run_channel(channel_t &channel) {
+  if ( channel.request_pending != EMPTY ) { /* a new request restarts the transfer */
+    if ( !_isotp_server_busToWrite->freeTxMailboxes() ) return;
+    noInterrupts();
+    channel.entry = channel.request_pending;
+    channel.request_pending = EMPTY;
+    interrupts();
+    channel.fc_pending = 0;
+    channel.index_pos = 6;
+    channel.index_sequence = 1;
+    channel.fc_wait_start = millis();
+    /* before the write, the peer's flow control can arrive before write() returns */
+    channel.state = ( entries[channel.entry].len <= 7 ) ? SERVER_IDLE : SERVER_WAIT_FC;
+    if ( !send_first_frame(channel) ) { /* ask again on the next call, unless a newer request came in */
+      channel.state = SERVER_IDLE;
+      channel.fc_pending = 0;
+      if ( channel.request_pending == EMPTY ) channel.request_pending = channel.entry;
+      return;
+    }
+    channel.last_frame = micros();
+    return;
+  }
 
+  if ( channel.state == SERVER_WAIT_FC ) {
+    if ( channel.fc_pending ) process_flow_control(channel);
+    else if ( millis() - channel.fc_wait_start >= N_BS_TIMEOUT ) channel.state = SERVER_IDLE;
+  }
 
+  while ( channel.state == SERVER_SEND ) {
+    if ( (micros() - channel.last_frame) < channel.separation_us ) return; /* STmin not over yet */
+    if ( !_isotp_server_busToWrite->freeTxMailboxes() ) return; /* try again on the next call */
+    bool last = channel.index_pos + 7 >= entries[channel.entry].len;
+    bool ends_block = !last && channel.block_size && channel.block_left == 1; /* the peer tells us how to go on */
+    if ( ends_block ) { /* as for the first frame, wait before the write */
+      channel.fc_wait_start = millis();
+      channel.state = SERVER_WAIT_FC;
+    }
+    if ( !send_next_frame(channel) ) { /* bus refused it, try again on the next call */
+      if ( ends_block ) {
+        channel.state = SERVER_SEND;
+        channel.fc_pending = 0;
+      }
+      return;
+    }
+    channel.last_frame = micros();
+    if ( last ) channel.state = SERVER_IDLE;
+    else if ( channel.block_size ) channel.block_left--;
+    if ( channel.separation_us ) return; /* one frame per call when paced */
+  }
+}
 
 
+ISOTPSERVER_FUNC void ISOTPSERVER_OPT::_process_frame_data(const CAN_message_t &msg) {
+  if ( !isotp_enabled ) return;
+  
+  #if defined(TEENSYDUINO)
+    if ( msg.bus != readBus ) return;
+  #endif
 
+  if ( (msg.buf[0] >> 4) == 3 ) { /* flow control frame */
+    int channel = find_channel(channel_key(msg.id, msg.flags.extended));
+    if ( channel >= 0 && channels[channel].state == SERVER_WAIT_FC ) {
+      channels[channel].fc[0] = msg.buf[0];
+      channels[channel].fc[1] = msg.buf[1];
+      channels[channel].fc[2] = msg.buf[2];
+      channels[channel].fc_pending = 1;
+    }
+    return;
+  }
 
+  uint32_t request = 0;
+  for ( uint8_t size = 1; size <= 4; size++ ) { /* at most one lookup per request length in use */
+    request = (request << 8) | msg.buf[size - 1];
+    if ( !(request_sizes & (1U << (size - 1))) ) continue;
+    int index = find_request(request_key(msg.id, msg.flags.extended, request, size));
+    if ( index >= 0 ) {
+      channels[entries[index].channel].request_pending = index; /* answered from events() */
+      return;
+    }
+  }
+}
 
 
-
+void ext_output3(const CAN_message_t &msg) {
+  for ( int i = 0; i < isotp_server_Base::buffer_hosts; i++ ) {
+#if defined(TEENSYDUINO)
+    if ( _ISOTPSERVER_OBJ[i]->readBus != msg.bus ) continue;
+#endif
+    _ISOTPSERVER_OBJ[i]->_process_frame_data(msg);
+    return; /* one server per bus, the first one registered on it gets the frame */
+  }
+}
@@ -0,0 +1,76 @@
+/*
+  MIT License
+
+  Copyright (c) 2018 Antonio Alexander Brewer (tonton81) - https://github.com/tonton81
+
+  Designed and tested for PJRC Teensy 4.0.
+
+  Forum link : https://forum.pjrc.com/threads/56035-isotp-FlexCAN-for-Teensy-4?highlight=isotp
+
+  Thanks goes to skpang, mjs513, and collin for tech/testing support
+
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in all
+  copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+  SOFTWARE.
+*/
+
+#if !defined(_ISOTP_TYPES_H_)
+#define _ISOTP_TYPES_H_
+
+#include "Arduino.h"
+
+/* shared by isotp and isotp_fd, so both can be used without pulling in the other's interrupt hook */
+
+typedef struct ISOTP_data {
+  uint32_t id = 0;                         /* can identifier */
+  struct {
+    bool extended = 0;                     /* identifier is extended (29-bit) */
+    bool usePadding = 0;                   /* padd and use all 8 bytes instead of truncating len */
+    bool separation_uS = 0;                /* separation time in uS (100-900uS only) */
+  } flags;
+  uint32_t len = 8;                        /* length of CAN message or callback payload */
+  uint16_t blockSize = 0;                  /* used for flow control, specify how many frame blocks per frame control request */
+  uint8_t flow_control_type = 0;           /* flow control type: 0: Clear to Send, 1: Wait, 2: Abort */
+  uint16_t separation_time = 0;            /* time between frames */
+  uint32_t flow_control_id = 0;            /* id the peer answers our first frames with flow control on, 0: same as id */
+} ISOTP_data;
+
+typedef enum ISOTP_RXBANKS_TABLE {
+  RX_BANKS_2 = (uint16_t)2,
+  RX_BANKS_4 = (uint16_t)4,
+  RX_BANKS_8 = (uint16_t)8,
+  RX_BANKS_16 = (uint16_t)16,
+  RX_BANKS_32 = (uint16_t)32,
+  RX_BANKS_64 = (uint16_t)64,
+  RX_BANKS_128 = (uint16_t)128,
+  RX_BANKS_256 = (uint16_t)256,
+  RX_BANKS_512 = (uint16_t)512,
+  RX_BANKS_1024 = (uint16_t)1024
+} ISOTP_RXBANKS_TABLE;
+
+typedef void (*_isotp_cb_ptr)(const ISOTP_data &config, const uint8_t *buf);
+
+typedef enum ISOTP_TX_STATUS {
+  ISOTP_TX_DONE,                           /* every frame was handed to the controller */
+  ISOTP_TX_CANCELLED,                      /* cancelWrite() was called */
+  ISOTP_TX_TIMEOUT,                        /* no flow control from the peer within N_Bs */
+  ISOTP_TX_OVERFLOW                        /* the peer can't take a message this long */
+} ISOTP_TX_STATUS;
+
+typedef void (*_isotp_tx_cb_ptr)(const ISOTP_data &config, ISOTP_TX_STATUS status);
+
+#endif
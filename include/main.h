@@ -5,6 +5,16 @@
 #include <nextion.h>
 #include <neopixel.h>
 #include <can.h>
+#include <tx_schedule.h>
+#include <diagnostics.h>
+#include <trace.h>
+
+int const shiftUp = 43;
+int const shiftDown = 42;
+int const button3 = 44;
+int const button4 = 45;
+int const button5 = 6;
+int const button6 = 9;
 
 extern CanInterface can;
 extern NextionInterface screen;
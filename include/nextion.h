@@ -3,6 +3,10 @@
 
 #include <Arduino.h>
 #include "can.h"
+#include "nextion_widgets.h"
+
+class NextionCommand;
+class NextionParser;
 
 enum page
 {
@@ -15,12 +19,188 @@ enum page
 
 class NextionInterface
 {
+public:
+    // what has gone out to the display since boot
+    struct linkStats {
+        uint32_t messages;
+        uint32_t bytes; // including the 0xFF terminators
+        uint32_t baud; // what negotiateBaud() settled on
+        uint32_t dropped; // one-off commands that found the output ring full
+        uint32_t failed; // answered with an error code
+        uint32_t unanswered; // no answer within ACK_TIMEOUT_MS
+        uint32_t overflows; // the display said its own input buffer overflowed
+    };
+
+    // what the display answered, per kind of command
+    struct commandStats {
+        uint32_t ok;
+        uint32_t failed;
+        uint8_t lastError; // the Nextion return code, 0 until one fails
+    };
+
+    // component ids are the ones set in the Nextion editor, pressed is false on release
+    typedef void (*touchHandler)(uint8_t page, uint8_t component, bool pressed);
+    // the page the display says it is on, after sendme or a page change made on the display
+    typedef void (*pageHandler)(uint8_t page);
+
 private:
     static short ctof(short celsius);
 
     static page current_page;
 
-    static void sendNextionMessage(String message);
+    // fields shown on the display, one dirty bit each, in NEXTION_WIDGETS order
+#define NEXTION_WIDGET_ENUM(name, ...) name,
+    enum field : uint8_t {
+        NEXTION_WIDGETS(NEXTION_WIDGET_ENUM)
+        FIELD_COUNT
+    };
+#undef NEXTION_WIDGET_ENUM
+    static_assert(FIELD_COUNT <= 16, "dirty and nextField's candidates are a bit per field, widen them");
+
+    // higher priority goes first. a field isn't resent within minInterval of the last time,
+    // and once it has waited maxStale it goes ahead of every field that hasn't
+    struct fieldSchedule {
+        uint8_t priority;
+        uint16_t minInterval; // ms
+        uint16_t maxStale; // ms
+    };
+
+    enum widgetFormat : uint8_t {
+        NUMBER,
+        FAHRENHEIT,
+        CHARACTER,
+        VALUE, // the rest go to .val
+        VALUE_FAHRENHEIT
+    };
+
+    // limits in stored units, see BANDS in nextion_widgets.h
+    struct colourBands {
+        bool enabled;
+        int32_t alarmLow;
+        int32_t warnLow;
+        int32_t warnHigh;
+        int32_t alarmHigh;
+        uint16_t hysteresis;
+    };
+
+    enum colourBand : uint8_t {
+        BAND_OK,
+        BAND_WARN,
+        BAND_ALARM,
+        BAND_UNKNOWN = 0xFF // no value yet, or the display's colour isn't known
+    };
+
+    // one line of NEXTION_WIDGETS, see nextion_widgets.h
+    struct widget {
+        const char *component;
+        uint8_t componentLength;
+        page shownOn;
+        widgetFormat format;
+        uint8_t decimals;
+        uint16_t quantum;
+        const char *suffix;
+        uint8_t suffixLength;
+        colourBands bands;
+        fieldSchedule schedule;
+    };
+
+    constexpr static const uint32_t RENDER_INTERVAL_MS = 50;
+    constexpr static const uint16_t BATCH_SIZE = 384; // a page command, every field and its colour at once
+
+    static const widget widgets[FIELD_COUNT];
+    static int32_t values[FIELD_COUNT]; // scaled by 10^decimals
+    static colourBand bands[FIELD_COUNT]; // what values[] is in
+    static colourBand sentBands[FIELD_COUNT]; // what the display is showing
+    static const uint16_t bandColours[];
+    static uint32_t lastSent[FIELD_COUNT];
+    static uint32_t dirtySince[FIELD_COUNT];
+
+    static uint16_t dirty;
+    static uint16_t known; // has had a value since boot, the others keep what the page draws
+    static uint32_t lastRender;
+    static uint8_t batch[BATCH_SIZE];
+    static uint16_t batchLength;
+    static uint16_t batchMessages;
+
+    constexpr static const uint16_t RING_SIZE = 1024; // power of two, about a second at 9600 baud
+    constexpr static const uint16_t RING_RESERVE = 64; // kept free of field updates for page changes
+
+    static uint8_t ring[RING_SIZE];
+    static uint16_t ringHead; // free running, masked on access
+    static uint16_t ringTail;
+
+    constexpr static const uint32_t PROBE_TIMEOUT_MS = 100;
+    constexpr static const uint32_t BAUD_SETTLE_MS = 20;
+    static const uint32_t baudRates[];
+
+    static void negotiateBaud();
+    static uint32_t findBaud();
+    static bool probe();
+
+    // what a command is counted as when its answer comes back: a field, or one of these
+    constexpr static const uint8_t TAG_PAGE = FIELD_COUNT;
+    constexpr static const uint8_t TAG_OTHER = FIELD_COUNT + 1;
+    constexpr static const uint8_t TAG_COUNT = FIELD_COUNT + 2;
+    constexpr static const uint8_t TAG_SYNC = 0xFE; // sendme, answered with 0x66 instead of 0x01
+    constexpr static const uint8_t TAG_UNTRACKED = 0xFF; // sent before bkcmd=3
+
+    struct pendingCommand {
+        uint8_t tag;
+        uint32_t sent;
+    };
+
+    constexpr static const uint8_t MAX_BATCH_MESSAGES = 32;
+    constexpr static const uint8_t IN_FLIGHT_SIZE = 64; // power of two
+    constexpr static const uint32_t ACK_TIMEOUT_MS = 500;
+    constexpr static const uint32_t SYNC_INTERVAL_MS = 1000;
+    constexpr static const uint32_t THROTTLE_MS = 250; // nothing goes out this long after an overflow
+    constexpr static const uint32_t THROTTLE_RECOVER_MS = 5000; // per halving of the budget
+    constexpr static const uint8_t MAX_THROTTLE = 3;
+    constexpr static const uint16_t RX_BUFFER_SIZE = 256; // on top of the 64 bytes HardwareSerial has
+    constexpr static const uint8_t RX_PER_TASK = 64;
+
+    static uint8_t batchTags[MAX_BATCH_MESSAGES];
+    static pendingCommand inFlight[IN_FLIGHT_SIZE];
+    static uint8_t inFlightHead; // free running, masked on access
+    static uint8_t inFlightTail;
+    static commandStats commands[TAG_COUNT];
+    static uint32_t lastSync;
+
+    static uint8_t throttle; // the render budget is shifted right by this
+    static bool paused;
+    static uint32_t pausedAt;
+    static uint32_t lastOverflow;
+
+    static uint8_t rxBuffer[RX_BUFFER_SIZE];
+    static NextionParser parser;
+    static touchHandler touchCallback;
+    static pageHandler pageCallback;
+
+    static void receive();
+    static void onMessage(const uint8_t *message, uint8_t length);
+    static void acknowledge(uint8_t code);
+    static void resync();
+    static void onOverflow();
+
+    static void sendNextionMessage(const char *message, uint8_t tag = TAG_OTHER);
+    static NextionCommand nextCommand();
+    static bool queueCommand(const NextionCommand &command, uint8_t tag);
+    static void flush();
+    static void drain();
+    static void drainAll();
+    static uint16_t ringFree();
+
+    static bool update(field f, int32_t value);
+    static bool updateScaled(field f, float value);
+    static void markDirty(field f);
+    static colourBand nextBand(field f, int32_t value);
+    static colourBand classify(const colourBands &limits, int32_t value, uint16_t margin);
+    static void render();
+    static int8_t nextField(uint16_t candidates, uint32_t now);
+    static uint16_t tickBudget();
+    static void switchTo(page p, const char *name);
+    static void formatField(field f, NextionCommand &command);
+    static void formatColour(field f, NextionCommand &command);
 
     static int const RGB565_GREEN = 1472;
     static int const RGB565_ORANGE = 47936;
@@ -30,21 +210,19 @@ private:
     static int const GREEN_BUTTON_ID = 19;
     static int const RED_BUTTON_ID = 20;
 
+    // the gear field shows N over these
     static bool neutral;
-    static uint8_t waterTemp;
-    static uint8_t oilTemp;
-    static uint16_t oilPressure;
-    static float batteryVoltage;
-    static uint16_t engineRPM;
-    static float lambda;
     static char gear;
 
-    static uint16_t currentMessage;
+    static linkStats link;
 public:
     NextionInterface();
 
     static void init();
 
+    // render tick, call from loop()
+    static void task();
+
     static void setWaterTemp(int value);
 
     static void setOilTemp(uint8_t value);
@@ -59,7 +237,7 @@ public:
 
     static void setGear(int gear);
 
-    static void setButtonImage(String elementName, bool value);
+    static void setButtonImage(const char *elementName, bool value);
 
     static void setFuelPumpBool(bool value);
     static void setFanBool(bool value);
@@ -84,6 +262,22 @@ public:
     static void switchToWarning();
 
     static page getCurrentPage();
+
+    // last values sent to the display
+    static uint8_t getWaterTemp();
+    static uint8_t getOilTemp();
+    static uint16_t getOilPressure();
+    static float getVoltage();
+    static uint16_t getRPM();
+    static float getLambda();
+    static char getGear();
+    static bool getNeutral();
+
+    static const linkStats &getLinkStats();
+    static void printLinkStats();
+
+    static void onTouch(touchHandler handler);
+    static void onPage(pageHandler handler);
 };
 
 #endif // NEXTION_H
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <Arduino.h>
+
+#ifndef NEXTION_COMMAND_H
+#define NEXTION_COMMAND_H
+
+/*
+Builds one Nextion instruction in place in a caller owned buffer, no String and no heap.
+Numbers come out exactly as the Arduino String constructors printed them: integers in
+decimal, fixed point with the given number of decimals and a leading "0." below one.
+If the instruction doesn't fit, ok() turns false and the buffer contents are garbage.
+*/
+class NextionCommand {
+public:
+    NextionCommand(uint8_t *buffer, uint16_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    // string literals, the length is known at compile time
+    template <size_t N>
+    NextionCommand &text(const char (&literal)[N]) {
+        return text(literal, N - 1);
+    }
+
+    NextionCommand &text(const char *s, uint16_t n) {
+        if (!reserve(n)) {
+            return *this;
+        }
+        memcpy(buffer + length, s, n);
+        length += n;
+        return *this;
+    }
+
+    NextionCommand &character(char c) {
+        if (reserve(1)) {
+            buffer[length++] = c;
+        }
+        return *this;
+    }
+
+    NextionCommand &integer(int32_t value) {
+        if (value < 0) {
+            character('-');
+            return digits(-(uint32_t)value);
+        }
+        return digits(value);
+    }
+
+    // value / 10^decimals, e.g. fixed(1234, 1) is "123.4"
+    NextionCommand &fixed(int32_t value, uint8_t decimals) {
+        uint32_t magnitude = value < 0 ? -(uint32_t)value : value;
+        uint32_t scale = 1;
+        for (uint8_t i = 0; i < decimals; i++) {
+            scale *= 10;
+        }
+        if (value < 0) {
+            character('-');
+        }
+        digits(magnitude / scale);
+        if (decimals == 0) {
+            return *this;
+        }
+        character('.');
+        uint32_t fraction = magnitude % scale;
+        for (scale /= 10; scale > 0; scale /= 10) {
+            character('0' + fraction / scale % 10);
+        }
+        return *this;
+    }
+
+    // rounded to decimals places, like String(value, decimals). scaled in double, a float
+    // product rounds values just below a half up
+    NextionCommand &decimal(float value, uint8_t decimals) {
+        double scale = 1;
+        for (uint8_t i = 0; i < decimals; i++) {
+            scale *= 10;
+        }
+        return fixed(lround(value * scale), decimals);
+    }
+
+    bool ok() const { return !overflow; }
+    uint16_t size() const { return length; }
+
+private:
+    uint8_t *buffer;
+    uint16_t capacity;
+    uint16_t length = 0;
+    bool overflow = false;
+
+    bool reserve(uint16_t n) {
+        if (overflow || length + n > capacity) {
+            overflow = true;
+            return false;
+        }
+        return true;
+    }
+
+    NextionCommand &digits(uint32_t value) {
+        char reversed[10];
+        uint8_t n = 0;
+        do {
+            reversed[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value != 0);
+        if (!reserve(n)) {
+            return *this;
+        }
+        while (n > 0) {
+            buffer[length++] = reversed[--n];
+        }
+        return *this;
+    }
+};
+
+#endif //NEXTION_COMMAND_H
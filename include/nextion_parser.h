@@ -0,0 +1,89 @@
+#include <Arduino.h>
+
+#ifndef NEXTION_PARSER_H
+#define NEXTION_PARSER_H
+
+/*
+Splits what the display sends back into messages, one byte at a time and without the heap.
+Everything the display sends ends in 0xFF 0xFF 0xFF. Most messages are just the code and the
+terminator, but a few carry binary data that can contain 0xFF itself, so for those the length
+is fixed by the code instead of found by looking for the terminator.
+The handler gets the message without the terminator, starting with the code.
+*/
+class NextionParser {
+public:
+    typedef void (*messageHandler)(const uint8_t *message, uint8_t length);
+
+    explicit NextionParser(messageHandler handler) : handler(handler) {}
+
+    void feed(uint8_t b) {
+        if (length == 0) {
+            expected = fixedLength(b);
+        }
+        if (length == MAX_MESSAGE) {
+            // a string longer than we care about, skip to the next terminator
+            dropped++;
+            length = 0;
+            skipping = true;
+        }
+        if (skipping) {
+            ffRun = b == 0xFF ? ffRun + 1 : 0;
+            if (ffRun == 3) {
+                skipping = false;
+                ffRun = 0;
+            }
+            return;
+        }
+        buffer[length++] = b;
+
+        if (expected != 0) {
+            if (length < expected) {
+                return;
+            }
+            if (terminated()) {
+                handler(buffer, length - 3);
+            } else {
+                // lost a byte somewhere, start over with whatever comes next
+                dropped++;
+            }
+            length = 0;
+            return;
+        }
+        if (length >= 4 && terminated()) {
+            handler(buffer, length - 3);
+            length = 0;
+        }
+    }
+
+    // messages thrown away because they didn't frame or were too long
+    uint32_t discarded() const { return dropped; }
+
+private:
+    constexpr static const uint8_t MAX_MESSAGE = 64;
+
+    messageHandler handler;
+    uint32_t dropped = 0;
+    uint8_t buffer[MAX_MESSAGE];
+    uint8_t length = 0;
+    uint8_t expected = 0;
+    uint8_t ffRun = 0;
+    bool skipping = false;
+
+    bool terminated() const {
+        return buffer[length - 1] == 0xFF && buffer[length - 2] == 0xFF && buffer[length - 3] == 0xFF;
+    }
+
+    // total length including the terminator, 0 if it ends at the first terminator
+    static uint8_t fixedLength(uint8_t code) {
+        switch (code) {
+            case 0x65: return 7; // touch: page, component, press
+            case 0x66: return 5; // current page
+            case 0x67: return 9; // touch coordinates: x (2), y (2), press
+            case 0x68: return 9; // same, while asleep
+            case 0x71: return 8; // numeric data, 4 bytes little endian
+            default: return 0;
+        }
+    }
+};
+
+#endif //NEXTION_PARSER_H
@@ -0,0 +1,75 @@
+// generated by tools/nextion_tft.py from tools/nextion_manifest.json and test/Nextion_Display.tft, do not edit
+
+#ifndef NEXTION_TFT_H
+#define NEXTION_TFT_H
+
+#include <stdint.h>
+
+class NextionTft {
+public:
+    constexpr static const char MODEL[] = "CN2E";
+    constexpr static const uint16_t WIDTH = 480;
+    constexpr static const uint16_t HEIGHT = 272;
+    constexpr static const uint32_t FILE_SIZE = 2503724;
+
+    constexpr static const char PAGE_LOADING[] = "loading";
+    constexpr static const char PAGE_STARTUP[] = "startup";
+    constexpr static const char PAGE_DRIVER[] = "driver";
+    constexpr static const char PAGE_YIPPEE[] = "yippee";
+    constexpr static const char PAGE_WARNING[] = "warning";
+
+    // page is the firmware's page enum entry as a string, e.g. "DRIVER", attribute is txt or val
+    constexpr static bool hasAttribute(const char *page, const char *name, const char *attribute) {
+        for (const component &c : components) {
+            if (equal(c.page, page) && equal(c.name, name)) {
+                return typeHasAttribute(c.type, attribute);
+            }
+        }
+        return false;
+    }
+
+    // type as the Nextion editor names it, e.g. "Dual-state button", attribute is txt or val
+    constexpr static bool typeHasAttribute(const char *type, const char *attribute) {
+        return equal(attribute, "txt") ? listed(TEXT_TYPES, type) : equal(attribute, "val") ? listed(VALUE_TYPES, type) : false;
+    }
+
+private:
+    struct component {
+        const char *page;
+        const char *name;
+        const char *type;
+    };
+
+    constexpr static const char *const TEXT_TYPES[] = { "Text", "Button", "Scrolling text", "Dual-state button", nullptr };
+    constexpr static const char *const VALUE_TYPES[] = { "Number", "XFloat", "Dual-state button", "Progress bar", "Gauge", "Slider", "Checkbox", "Radio", nullptr };
+
+    constexpr static const component components[] = {
+        { "DRIVER", "watertempvalue", "Text" },
+        { "DRIVER", "oiltempvalue", "Text" },
+        { "DRIVER", "oilpressvalue", "Text" },
+        { "DRIVER", "voltvalue", "Text" },
+        { "DRIVER", "MessageDriver", "Text" },
+        { "DRIVER", "rpm", "Text" },
+        { "DRIVER", "gear", "Text" },
+        { "DRIVER", "lambdabool", "Text" },
+    };
+
+    constexpr static bool listed(const char *const *types, const char *type) {
+        for (; *types != nullptr; types++) {
+            if (equal(*types, type)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr static bool equal(const char *a, const char *b) {
+        while (*a != '\0' && *a == *b) {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+};
+
+#endif //NEXTION_TFT_H
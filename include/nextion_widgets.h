@@ -0,0 +1,58 @@
+#ifndef NEXTION_WIDGETS_H
+#define NEXTION_WIDGETS_H
+
+/*
+Every value the wheel shows on the display, one line each. NextionInterface generates its
+field enum, its value store and its binding table from this list, so a new channel is a new
+line here plus a setter that calls update().
+
+  name         field enum entry
+  component    object name in the Nextion editor
+  page         the page it is on, it's only sent while that page is showing
+  format       to .txt as a quoted string, NUMBER: value / 10^decimals, FAHRENHEIT: value is
+               Celsius, CHARACTER: one char
+               to .val as a bare integer, VALUE: the stored value, VALUE_FAHRENHEIT: value is
+               Celsius
+  decimals     values are stored as integers scaled by 10^decimals, 0 for the Fahrenheit formats
+  quantum      stored values are rounded down to a multiple of this, changes below it are
+               never sent
+  suffix       appended after the value, inside the quotes, "" for .val
+  initial      what the getters return before the first update, never sent: a field keeps
+               what the page draws until something sets it
+  bands        text colour by value, see below
+  priority, minInterval, maxStale   the render schedule, see fieldSchedule
+
+The gear goes out in the next tick whatever else is waiting, the voltage is noisy and the
+least urgent.
+
+A .val widget is a Number component, or an XFloat with vvs1 set to decimals, with its unit as
+a static label next to it on the page. oilpressvalue.val=42 is 23 bytes on the wire against
+29 for oilpressvalue.txt="42 PSI", and there's no text to build. The component name is most of
+what is left. The components here are still Text in the display project, a row moves over
+together with its type in tools/nextion_manifest.json and the HMI, the build checks they agree.
+
+BANDS(alarmLow, warnLow, warnHigh, alarmHigh, hysteresis) colours the text green, orange at or
+past a warn limit and red at or past an alarm limit, in stored units. Going back to a calmer
+colour takes hysteresis more than the limit, so a value sitting on a limit doesn't flicker.
+The .pco command only goes out when the colour changes, in the same batch as the value.
+NO_LIMIT leaves a side open. The lambda limits are the ones Powertrain gave us, the others are
+starting points to tune on the car.
+*/
+
+#define NO_LIMIT_LOW INT32_MIN
+#define NO_LIMIT_HIGH INT32_MAX
+#define BANDS(alarmLow, warnLow, warnHigh, alarmHigh, hysteresis) { true, alarmLow, warnLow, warnHigh, alarmHigh, hysteresis }
+#define NO_BANDS { false, 0, 0, 0, 0, 0 }
+
+//  name            component          page    format      dec quantum suffix        initial bands                                                   prio minInterval maxStale
+#define NEXTION_WIDGETS(X) \
+    X(WATER_TEMP,     "watertempvalue",  DRIVER, FAHRENHEIT, 0,  1,      " \xB0" "F",  1,      BANDS(NO_LIMIT_LOW, NO_LIMIT_LOW, 100, 108, 2),         4,   250,        1000) \
+    X(OIL_TEMP,       "oiltempvalue",    DRIVER, FAHRENHEIT, 0,  1,      " \xB0" "F",  1,      BANDS(NO_LIMIT_LOW, NO_LIMIT_LOW, 120, 135, 3),         4,   250,        1000) \
+    X(OIL_PRESSURE,   "oilpressvalue",   DRIVER, NUMBER,     0,  1,      " PSI",       1,      BANDS(10, 20, NO_LIMIT_HIGH, NO_LIMIT_HIGH, 2),         5,   100,        500)  \
+    X(VOLTAGE,        "voltvalue",       DRIVER, NUMBER,     1,  1,      " V",         -10,    BANDS(118, 125, NO_LIMIT_HIGH, NO_LIMIT_HIGH, 2),       2,   500,        2000) \
+    X(DRIVER_MESSAGE, "MessageDriver",   DRIVER, NUMBER,     0,  1,      "",           0,      NO_BANDS,                                               6,   0,          200)  \
+    X(RPM,            "rpm",             DRIVER, NUMBER,     0,  100,    "",           1,      NO_BANDS,                                               5,   100,        250)  \
+    X(GEAR,           "gear",            DRIVER, CHARACTER,  0,  1,      "",           '?',    NO_BANDS,                                               7,   0,          50)   \
+    X(LAMBDA,         "lambdabool",      DRIVER, NUMBER,     3,  1,      " LA",        -1000,  BANDS(500, 800, 1200, 1500, 20),                        3,   200,        1000)
+
+#endif //NEXTION_WIDGETS_H
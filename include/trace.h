@@ -0,0 +1,110 @@
+#include <Arduino.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+Logging for the CAN and display paths, where a Serial.print costs tens of microseconds and
+blocks outright while the USB host isn't reading.
+LOG_ERROR() .. LOG_TRACE() take an event from TRACE_EVENTS and up to four integers. Levels
+above LOG_LEVEL compile to nothing, arguments included. Enabled ones store a fixed size binary
+record (cycle counter, event, the integers) in a ring, which task() formats and writes to
+Serial from the loop, only as much as USB will take without waiting.
+Records can come from interrupts and the loop at the same time, a slot is claimed with a
+compare and swap on the head and marked done once written. When the ring is full new records
+are counted and dropped.
+
+Set the level with -D LOG_LEVEL=LOG_LEVEL_DEBUG in build_flags.
+*/
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// name, printf format for the arguments (recorded as uint32_t, printed as unsigned: %u %d %X %c)
+#define TRACE_EVENTS(X) \
+    X(CAN_FRAME,          "CAN 0x%X len %u data %08X %08X") \
+    X(CAN_BUS_OFF,        "CAN bus off, TEC %u REC %u") \
+    X(CAN_RECOVERED,      "CAN recovered after %u ms") \
+    X(OIL_PRESSURE_RAW,   "oil pressure raw 0x%X 0x%X, %u PSI") \
+    X(GEAR,               "gear %c") \
+    X(LAMBDA,             "lambda %d/1000") \
+    X(DISPLAY_FAILED,     "display command %u failed with 0x%02X") \
+    X(DISPLAY_OVERFLOW,   "display buffer overflow, throttle %u")
+
+#define TRACE_EVENT_ENUM(name, format) name,
+
+enum class TraceEvent : uint8_t {
+    TRACE_EVENTS(TRACE_EVENT_ENUM)
+    COUNT
+};
+
+#undef TRACE_EVENT_ENUM
+
+class Trace {
+public:
+    static void record(uint8_t level, TraceEvent event, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0, uint32_t d = 0);
+
+    // writes out what USB has room for, call from loop()
+    static void task();
+
+    static uint32_t dropped();
+
+private:
+    struct entry {
+        volatile uint32_t sequence; // index + 1 once the record is complete
+        uint32_t cycles;
+        TraceEvent event;
+        uint8_t level;
+        uint32_t args[4];
+    };
+
+    constexpr static const uint16_t RING_SIZE = 128; // power of two
+    constexpr static const uint16_t LINE_MAX = 96;
+
+    static entry ring[RING_SIZE];
+    static volatile uint32_t head; // free running
+    static volatile uint32_t tail;
+    static volatile uint32_t droppedRecords;
+
+    static const char *const formats[];
+};
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(event, ...) Trace::record(LOG_LEVEL_ERROR, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(event, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(event, ...) Trace::record(LOG_LEVEL_WARN, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define LOG_WARN(event, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(event, ...) Trace::record(LOG_LEVEL_INFO, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define LOG_INFO(event, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(event, ...) Trace::record(LOG_LEVEL_DEBUG, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(event, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(event, ...) Trace::record(LOG_LEVEL_TRACE, TraceEvent::event, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(event, ...) ((void)0)
+#endif
+
+#endif //TRACE_H
@@ -0,0 +1,83 @@
+#include <FlexCAN_T4.h>
+#include <IntervalTimer.h>
+
+#ifndef TX_SCHEDULE_H
+#define TX_SCHEDULE_H
+
+/*
+Time-triggered transmit schedule for the frames the wheel owns (paddles, buttons, heartbeat).
+Every entry has a fixed period and a start offset in milliseconds. The offsets are staggered so
+no two entries ever come due on the same tick, which keeps our frames from bursting onto the bus
+together. A 1 kHz IntervalTimer walks the table and marks what is due, task() sends it from
+loop(), and for every frame sent we record how far the write was from the planned time.
+
+The timer doesn't write itself: FlexCAN_T4's mailbox search and its TX queue aren't reentrant,
+and loop() writes to Can0 too (ISO-TP, diagnostics), so a write from the interrupt could land
+in the middle of one of those. The jitter is therefore the timer plus however long loop() takes
+to come round, which is what the bus actually sees.
+*/
+class CanTxSchedule {
+public:
+    // fills msg.buf and msg.len for one scheduled frame, called from task()
+    typedef void (*payloadBuilder)(CAN_message_t &msg);
+
+    struct entry {
+        uint32_t id;
+        uint16_t period; // ms
+        uint16_t offset; // ms
+        payloadBuilder build;
+    };
+
+    // actual - planned send time, in microseconds
+    struct timing {
+        uint32_t sent;
+        uint32_t dropped; // write() refused the frame, or task() didn't get to it within a period
+        int32_t lastError;
+        int32_t minError;
+        int32_t maxError;
+        uint32_t sumAbsError; // divide by sent for the mean jitter
+    };
+
+    static void begin();
+    static void stop();
+    // around a controller re-init, resume() picks the grid up again if it was running
+    static void suspend();
+    static void resume();
+
+    // sends what the timer marked due, call from loop()
+    static void task();
+
+    static uint8_t size();
+    static const entry &getEntry(uint8_t index);
+    static timing getTiming(uint8_t index);
+    static void resetTiming();
+
+    static void printTiming();
+
+private:
+    constexpr static const uint32_t TICK_US = 1000;
+    constexpr static const uint8_t MAX_ENTRIES = 8;
+
+    static const entry schedule[];
+    static const uint8_t scheduleSize;
+
+    static IntervalTimer timer;
+    static bool running;
+    static bool suspended;
+    static volatile uint32_t tick;
+    static uint32_t startMicros;
+    static uint32_t nextDue[MAX_ENTRIES]; // in ticks since start(), timer only
+    static volatile uint8_t due; // one bit per entry, set by the timer, cleared by task()
+    static volatile uint32_t planned[MAX_ENTRIES]; // micros() the pending frame was due at
+    static volatile timing timings[MAX_ENTRIES];
+
+    static bool offsetsCollide(const entry &a, const entry &b);
+    static void start();
+    static void onTick();
+
+    static void buildShift(CAN_message_t &msg);
+    static void buildButtons(CAN_message_t &msg);
+    static void buildHeartbeat(CAN_message_t &msg);
+};
+
+#endif //TX_SCHEDULE_H
\ No newline at end of file
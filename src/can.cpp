@@ -2,6 +2,10 @@
 
 #include "nextion.h"
 #include "neopixel.h"
+#include "can_errors.h"
+#include "trace.h"
+
+#include <inttypes.h>
 
 FlexCAN_T4<CAN2, RX_SIZE_256, TX_SIZE_16> CanInterface::Can0;
 
@@ -11,87 +15,148 @@ CanInterface::CanInterface(){
 
 CAN_message_t CanInterface::shift_msg;
 bool CanInterface::canActive = false;
+volatile uint32_t CanInterface::lastFrameMillis = 0;
+volatile uint32_t CanInterface::framesReceived = 0;
+volatile uint8_t CanInterface::warningMask = 0;
+
+/*
+Each ID we decode has its own handler, dispatched by FlexCAN's per-ID hash table so a frame
+costs one lookup instead of walking a switch. IDs that aren't listed here get no handler, only
+receive_can_updates() sees them.
+TO DO:
+Some of the IDs are written as ints, others are in hexcode, convert all hexcode IDs
+to their integer value.
+*/
+const CanInterface::receiveHandler CanInterface::receive_handlers[] = {
+    { 1600,  receive_rpm },
+    { 0x649, receive_temps },
+    { 0x64C, receive_warnings },
+    { 0x64D, receive_gear },
+    { 1284,  receive_pumps },
+    { 1604,  receive_oil_pressure },
+    { 1617,  receive_lambda },
+    { 2047,  receive_warning_flags },
+};
 
 bool CanInterface::init(){
     pinMode(32,OUTPUT); digitalWrite(32,HIGH);
     pinMode(33,OUTPUT); digitalWrite(33,HIGH);
 
+    restart();
+
+    // handlers survive restart(), so they only need registering once
+    for (const receiveHandler &h : receive_handlers) {
+        if (!Can0.onReceiveId(h.id, h.handler)) {
+            Serial.printf("CAN: no room for a handler for 0x%" PRIX32 "\n", h.id);
+        }
+    }
+    return 1;
+}
+
+/*
+Also used by CanErrorSupervisor to bring the controller back after a bus-off. begin() soft
+resets the controller, clears every mailbox and drops attachObj() listeners, so everything
+set up on the hardware is redone here: rate, mailbox count, the FIFO and its interrupt, and
+the catch-all receive callback. The per-ID handlers, the static listeners and the ISO-TP
+hooks live in software and survive it. No FIFO filters are set, it takes every frame.
+*/
+void CanInterface::restart(){
     Can0.begin();
     Can0.setBaudRate(1000000); //needs to be million to talk with CAN
     Can0.setMaxMB(16);
     Can0.enableFIFO();
     Can0.enableFIFOInterrupt();
     Can0.onReceive(receive_can_updates);
-    return 1;
 }
 
+uint8_t CanInterface::receiveIdCount(){
+    return sizeof(receive_handlers) / sizeof(receive_handlers[0]);
+}
+
+uint32_t CanInterface::receiveId(uint8_t index){
+    return receive_handlers[index].id;
+}
+
+// a trace record, only built with LOG_LEVEL_TRACE. data is the 8 buffer bytes, big endian
 void CanInterface::print_can_sniff(const CAN_message_t &msg){
-    Serial.print("MB "); Serial.print(msg.mb);
-    Serial.print("  OVERRUN: "); Serial.print(msg.flags.overrun);
-    Serial.print("  LEN: "); Serial.print(msg.len);
-    Serial.print(" EXT: "); Serial.print(msg.flags.extended);
-    Serial.print(" TS: "); Serial.print(msg.timestamp);
-    Serial.print(" ID: "); Serial.print(msg.id, DEC);
-    Serial.print(" Buffer: ");
-    for ( uint8_t i = 0; i < msg.len; i++ ) {
-        Serial.print(msg.buf[i], DEC); Serial.print(" ");
-    } 
-    Serial.println();
+    LOG_TRACE(CAN_FRAME, msg.id, msg.len,
+        (msg.buf[0] << 24) | (msg.buf[1] << 16) | (msg.buf[2] << 8) | msg.buf[3],
+        (msg.buf[4] << 24) | (msg.buf[5] << 16) | (msg.buf[6] << 8) | msg.buf[7]);
 }
 
+// runs for every frame, after its per-ID handler if it has one (see FlexCAN_T4::mbCallbacks)
 void CanInterface::receive_can_updates(const CAN_message_t &msg) {
     canActive = true;
+    lastFrameMillis = millis();
+    framesReceived++;
+    print_can_sniff(msg);
+}
+
+void CanInterface::receive_rpm(const CAN_message_t &msg) {
+    //rpm
+}
+
+void CanInterface::receive_temps(const CAN_message_t &msg) {
+    NextionInterface::setWaterTemp(msg.buf[0] -40);
+    NextionInterface::setOilTemp(msg.buf[1] - 40);
+    NextionInterface::setVoltage(msg.buf[5] * 0.1);
+}
 
+void CanInterface::receive_warnings(const CAN_message_t &msg) {
+    //coolantTempWarning, oilTempWarning, oilPressureWarning, fuelPressureWarning
+
+    /*if (any of the warnings) {
+        NextionInterface::switchToWarning();
+    } else { // otherwise switch to driver screen
+        NextionInterface::switchToDriver();
+    }*/
+}
+
+void CanInterface::receive_gear(const CAN_message_t &msg) {
+    NextionInterface::setGear(msg.buf[6] & 0x0F);
+}
+
+void CanInterface::receive_pumps(const CAN_message_t &msg) {
+    // WaterPump, FuelPump, Fan
+}
+
+void CanInterface::receive_oil_pressure(const CAN_message_t &msg) {
+    // OilPressure
+}
+
+// TODO: machine light indicator (MLI)
+void CanInterface::receive_lambda(const CAN_message_t &msg) {
+    //lambda
+}
+
+void CanInterface::receive_warning_flags(const CAN_message_t &msg) {
+    // this is for warnings. if any value is greater than 0 it's big bad
+    uint8_t mask = 0;
+    for (uint8_t i = 0; i < msg.len; i++) {
+        mask |= (msg.buf[i] != 0) << i;
+    }
+    warningMask = mask;
+    if (mask) {
+        // TODO
+    }
+}
+
+void CanInterface::packShift(CAN_message_t &msg, const bool up, const bool down, const bool button3){
+    msg.len = 1;
+    msg.buf[0] = (up << 0) | (down << 1) | (button3 << 2);
+}
 
-    switch (msg.id){
-        /*
-        TO DO:
-        The following code contains the cases for each of the sensor values gathered from CAN.
-        One of the cases below has been filled in as an example.
-
-        Additionally, some of the cases are written as ints, others are in hexcode, convert all hexcode cases
-        to their integer value.
-        */
-        case 1600:
-            //rpm
-            break;
-        case 0x649:
-            NextionInterface::setWaterTemp(msg.buf[0] -40);
-            NextionInterface::setOilTemp(msg.buf[1] - 40);
-            NextionInterface::setVoltage(msg.buf[5] * 0.1);
-            break;
-        case 0x64C:
-            //coolantTempWarning, oilTempWarning, oilPressureWarning, fuelPressureWarning
-
-            /*if (any of the warnings) {
-                NextionInterface::switchToWarning();
-            } else { // otherwise switch to driver screen
-                NextionInterface::switchToDriver();
-            }*/
-            break;
-        case 0x64D:
-            NextionInterface::setGear(msg.buf[6] & 0x0F);
-            break;
-        case 1284:
-            // WaterPump, FuelPump, Fan
-            break;
-        case 1604:
-            // OilPressure
-            break;
-        // TODO: machine light indicator (MLI)
-        case 1617:
-            //lambda
-            break;
-        case 2047:
-            // this is for warnings. if any value is greater than 0 it's big bad
-            if (msg.buf != 0) {
-                // TODO
-            }
-        default:
-            break;
+// one-off shift frame, the periodic one goes out through CanTxSchedule
+void CanInterface::send_shift(const bool up, const bool down, const bool button3){
+    if (!TX_IDS_CONFIRMED) {
+        return;
     }
+    shift_msg.id = SHIFT_ID;
+    packShift(shift_msg, up, down, button3);
+    Can0.write(shift_msg);
 }
 
 void CanInterface::task(){
     Can0.events();
+    CanErrorSupervisor::task();
 }
\ No newline at end of file
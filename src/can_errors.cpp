@@ -0,0 +1,151 @@
+#include "can_errors.h"
+
+#include "can.h"
+#include "tx_schedule.h"
+#include "trace.h"
+
+#include <inttypes.h>
+
+CanErrorSupervisor::metrics CanErrorSupervisor::stats = {};
+CanErrorSupervisor::errorCounters CanErrorSupervisor::window = {};
+
+uint32_t CanErrorSupervisor::windowStart = 0;
+uint8_t CanErrorSupervisor::windowTec = 0;
+uint8_t CanErrorSupervisor::windowRec = 0;
+
+uint32_t CanErrorSupervisor::busOffSince = 0;
+uint32_t CanErrorSupervisor::nextReinit = 0;
+uint32_t CanErrorSupervisor::backoff = CanErrorSupervisor::BACKOFF_MIN_MS;
+uint32_t CanErrorSupervisor::activeSince = 0;
+
+void CanErrorSupervisor::task() {
+    uint32_t now = millis();
+
+    CAN_error_t error;
+    while (CanInterface::Can0.error(error, false)) {
+        decodeSnapshot(error);
+    }
+
+    updateCounters(CanInterface::Can0.getECR());
+    updateState(CanInterface::Can0.getESR1(), now);
+
+    if (now - windowStart >= WINDOW_MS) {
+        rollWindow(now);
+    }
+}
+
+CanErrorSupervisor::busState CanErrorSupervisor::getState() {
+    return stats.state;
+}
+
+const CanErrorSupervisor::metrics &CanErrorSupervisor::getMetrics() {
+    return stats;
+}
+
+void CanErrorSupervisor::printMetrics() {
+    static const char *names[] = { "active", "passive", "bus off", "recovering" };
+    Serial.printf("CAN %s TEC %u (peak %u, %+d/s) REC %u (peak %u, %+d/s)\n", names[stats.state],
+        stats.tec, stats.tecPeak, stats.tecTrend, stats.rec, stats.recPeak, stats.recTrend);
+    Serial.printf("  errors/s bit %" PRIu32 " ack %" PRIu32 " crc %" PRIu32 " form %" PRIu32 " stuff %" PRIu32 "\n",
+        stats.perSecond.bit, stats.perSecond.ack, stats.perSecond.crc, stats.perSecond.form, stats.perSecond.stuff);
+    Serial.printf("  passive %" PRIu32 " bus off %" PRIu32 " reinit %" PRIu32 " recovered %" PRIu32
+        " (last %" PRIu32 "ms, max %" PRIu32 "ms)\n", stats.passiveCount, stats.busOffCount, stats.reinitCount,
+        stats.recoveries, stats.lastRecoveryMs, stats.maxRecoveryMs);
+}
+
+void CanErrorSupervisor::decodeSnapshot(const CAN_error_t &error) {
+    if (error.BIT0_ERR || error.BIT1_ERR) window.bit++;
+    if (error.ACK_ERR) window.ack++;
+    if (error.CRC_ERR) window.crc++;
+    if (error.FRM_ERR) window.form++;
+    if (error.STF_ERR) window.stuff++;
+}
+
+void CanErrorSupervisor::updateCounters(uint32_t ecr) {
+    stats.tec = ecr & 0xFF;
+    stats.rec = (ecr >> 8) & 0xFF;
+    if (stats.tec > stats.tecPeak) stats.tecPeak = stats.tec;
+    if (stats.rec > stats.recPeak) stats.recPeak = stats.rec;
+}
+
+void CanErrorSupervisor::updateState(uint32_t esr1, uint32_t now) {
+    // ESR1 FLTCONF: 00 error active, 01 error passive, 1x bus off
+    uint8_t fltconf = (esr1 >> 4) & 0x3;
+    bool busOff = fltconf >= 2;
+    bool passive = fltconf == 1;
+
+    switch (stats.state) {
+        case ERROR_ACTIVE:
+        case ERROR_PASSIVE:
+            if (busOff) {
+                stats.state = BUS_OFF;
+                stats.busOffCount++;
+                LOG_WARN(CAN_BUS_OFF, stats.tec, stats.rec);
+                busOffSince = now;
+                nextReinit = now + backoff;
+                CanInterface::canActive = false;
+            } else if (passive && stats.state == ERROR_ACTIVE) {
+                stats.state = ERROR_PASSIVE;
+                stats.passiveCount++;
+            } else if (!passive && stats.state == ERROR_PASSIVE) {
+                stats.state = ERROR_ACTIVE;
+                activeSince = now;
+            } else if (stats.state == ERROR_ACTIVE && now - activeSince >= STABLE_MS) {
+                backoff = BACKOFF_MIN_MS;
+            }
+            break;
+
+        case BUS_OFF:
+            if (!busOff) {
+                // the controller came back by itself (128 x 11 recessive bits)
+                stats.state = RECOVERING;
+            } else if ((int32_t)(now - nextReinit) >= 0) {
+                reinit(now);
+                stats.state = RECOVERING;
+            }
+            break;
+
+        case RECOVERING:
+            if ((int32_t)(CanInterface::lastFrameMillis - busOffSince) > 0) {
+                stats.lastRecoveryMs = CanInterface::lastFrameMillis - busOffSince;
+                if (stats.lastRecoveryMs > stats.maxRecoveryMs) stats.maxRecoveryMs = stats.lastRecoveryMs;
+                stats.recoveries++;
+                LOG_INFO(CAN_RECOVERED, stats.lastRecoveryMs);
+                stats.state = passive ? ERROR_PASSIVE : ERROR_ACTIVE;
+                activeSince = now;
+            } else if (busOff) {
+                stats.state = BUS_OFF;
+            } else if ((int32_t)(now - nextReinit) >= 0) {
+                // off the bus-off but still nothing received, try again
+                reinit(now);
+            }
+            break;
+    }
+}
+
+// the TX schedule writes to Can0 from loop() too, it stays off while the controller is reset
+void CanErrorSupervisor::reinit(uint32_t now) {
+    CanTxSchedule::suspend();
+    CanInterface::restart();
+    CanTxSchedule::resume();
+    stats.reinitCount++;
+    backoff = min(backoff * 2, BACKOFF_MAX_MS);
+    nextReinit = now + backoff;
+}
+
+void CanErrorSupervisor::rollWindow(uint32_t now) {
+    stats.perSecond = window;
+    stats.total.bit += window.bit;
+    stats.total.ack += window.ack;
+    stats.total.crc += window.crc;
+    stats.total.form += window.form;
+    stats.total.stuff += window.stuff;
+    window = {};
+
+    stats.tecTrend = (int16_t)stats.tec - windowTec;
+    stats.recTrend = (int16_t)stats.rec - windowRec;
+    windowTec = stats.tec;
+    windowRec = stats.rec;
+
+    windowStart = now;
+}
\ No newline at end of file
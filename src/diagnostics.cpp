@@ -0,0 +1,186 @@
+#include "diagnostics.h"
+
+#include <isotp.h>
+
+#include "can.h"
+#include "can_errors.h"
+#include "nextion.h"
+
+/*
+isotp.h defines the ext_output2 hook the CAN interrupt feeds it through, so it can only be
+included from this one file and the transport lives here instead of in the class.
+Requests are a single frame, so the reassembly slots are 7 bytes: any first frame announces at
+least 8 and is dropped before it claims one. The transport only reads REQUEST_ID, which is also
+where the tester's flow control for a long answer comes from.
+*/
+static isotp<RX_BANKS_2, 7> transport;
+
+const DiagnosticService::dataIdentifier DiagnosticService::identifiers[] = {
+    { 0xF200, DiagnosticService::readLiveState },
+    { 0xF201, DiagnosticService::readCanStats },
+    { 0xF202, DiagnosticService::readDisplayLink },
+};
+
+volatile bool DiagnosticService::requestPending = false;
+volatile uint8_t DiagnosticService::requestLength = 0;
+volatile uint8_t DiagnosticService::request[7];
+
+uint8_t DiagnosticService::response[MAX_RESPONSE];
+
+static void receiveRequest(const ISOTP_data &config, const uint8_t *buf) {
+    DiagnosticService::onRequest(config.flags.extended ? 0 : config.id, buf, config.len);
+}
+
+void DiagnosticService::init() {
+    transport.setWriteBus(&CanInterface::Can0);
+    transport.setReadId(REQUEST_ID);
+    transport.onReceive(receiveRequest);
+    transport.begin();
+}
+
+void DiagnosticService::onRequest(uint32_t id, const uint8_t *buf, uint8_t len) {
+    // a request still being answered wins
+    if (id != REQUEST_ID || len == 0 || len > sizeof(request) || requestPending) {
+        return;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        request[i] = buf[i];
+    }
+    requestLength = len;
+    requestPending = true;
+}
+
+void DiagnosticService::task() {
+    transport.events();
+
+    if (!requestPending || transport.writeBusy()) {
+        return;
+    }
+
+    uint8_t req[sizeof(request)];
+    uint8_t len = requestLength;
+    for (uint8_t i = 0; i < len; i++) {
+        req[i] = request[i];
+    }
+    requestPending = false;
+
+    uint16_t size = buildResponse(req, len);
+
+    ISOTP_data config;
+    config.id = RESPONSE_ID;
+    config.flow_control_id = REQUEST_ID;
+    config.flags.usePadding = 1;
+    transport.writeAsync(config, response, size);
+}
+
+uint16_t DiagnosticService::buildResponse(const uint8_t *req, uint8_t len) {
+    if (req[0] != READ_DATA_BY_ID) {
+        return negativeResponse(req[0], NRC_SERVICE_NOT_SUPPORTED);
+    }
+    if (len < 3 || (len - 1) % 2 != 0) {
+        return negativeResponse(req[0], NRC_INCORRECT_LENGTH);
+    }
+
+    uint8_t *out = response;
+    *out++ = READ_DATA_BY_ID + POSITIVE_RESPONSE;
+
+    for (uint8_t i = 1; i < len; i += 2) {
+        uint16_t id = (req[i] << 8) | req[i + 1];
+        for (const dataIdentifier &d : identifiers) {
+            if (d.id != id) {
+                continue;
+            }
+            uint16_t room = response + MAX_RESPONSE - out;
+            if (room < 2) {
+                return negativeResponse(req[0], NRC_RESPONSE_TOO_LONG);
+            }
+            uint16_t written = d.read(put16(out, id), room - 2);
+            if (written == 0) {
+                return negativeResponse(req[0], NRC_RESPONSE_TOO_LONG);
+            }
+            out += 2 + written;
+            break;
+        }
+    }
+
+    if (out == response + 1) {
+        return negativeResponse(req[0], NRC_OUT_OF_RANGE);
+    }
+    return out - response;
+}
+
+uint16_t DiagnosticService::negativeResponse(uint8_t service, uint8_t code) {
+    response[0] = NEGATIVE_RESPONSE;
+    response[1] = service;
+    response[2] = code;
+    return 3;
+}
+
+uint16_t DiagnosticService::readLiveState(uint8_t *out, uint16_t room) {
+    if (room < 15) {
+        return 0;
+    }
+    *out++ = NextionInterface::getWaterTemp();
+    *out++ = NextionInterface::getOilTemp();
+    out = put16(out, NextionInterface::getOilPressure());
+    out = put16(out, (int16_t)roundf(NextionInterface::getVoltage() * 10));
+    out = put16(out, NextionInterface::getRPM());
+    out = put16(out, (int16_t)roundf(NextionInterface::getLambda() * 1000));
+    *out++ = NextionInterface::getGear();
+    *out++ = NextionInterface::getNeutral();
+    *out++ = CanInterface::warningMask;
+    *out++ = CanInterface::canActive;
+    *out++ = NextionInterface::getCurrentPage();
+    return 15;
+}
+
+uint16_t DiagnosticService::readCanStats(uint8_t *out, uint16_t room) {
+    uint8_t ids = CanInterface::receiveIdCount();
+    uint16_t size = 10 + 6 * ids;
+    if (room < size) {
+        return 0;
+    }
+
+    const CanErrorSupervisor::metrics &errors = CanErrorSupervisor::getMetrics();
+    out = put32(out, CanInterface::framesReceived);
+    *out++ = errors.state;
+    *out++ = errors.tec;
+    *out++ = errors.rec;
+    out = put16(out, min(errors.busOffCount, (uint32_t)0xFFFF));
+    *out++ = ids;
+    for (uint8_t i = 0; i < ids; i++) {
+        uint32_t id = CanInterface::receiveId(i);
+        out = put16(out, id);
+        out = put32(out, CanInterface::Can0.idFrameCount(id));
+    }
+    return size;
+}
+
+uint16_t DiagnosticService::readDisplayLink(uint8_t *out, uint16_t room) {
+    if (room < 28) {
+        return 0;
+    }
+    const NextionInterface::linkStats &link = NextionInterface::getLinkStats();
+    out = put32(out, link.messages);
+    out = put32(out, link.bytes);
+    out = put32(out, link.baud);
+    out = put32(out, link.dropped);
+    out = put32(out, link.failed);
+    out = put32(out, link.unanswered);
+    out = put32(out, link.overflows);
+    return 28;
+}
+
+uint8_t *DiagnosticService::put16(uint8_t *out, uint16_t value) {
+    out[0] = value >> 8;
+    out[1] = value;
+    return out + 2;
+}
+
+uint8_t *DiagnosticService::put32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+    return out + 4;
+}
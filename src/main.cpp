@@ -1,22 +1,8 @@
 #include "main.h"
 #include "neopixel.h"
 
-#include <IntervalTimer.h>
-
-// Define the callback function
-void shifterCallback(); 
 void buttonsCallback();
 
-// Create an IntervalTimer object
-IntervalTimer timer;
-
-int const shiftUp = 43;
-int const shiftDown = 42;
-int const button3 = 44;
-int const button4 = 45;
-int const button5 = 6;
-int const button6 = 9;
-
 void setup() {
   pinMode(shiftUp, INPUT_PULLUP);
   pinMode(shiftDown, INPUT_PULLUP);
@@ -33,15 +19,20 @@ void setup() {
   Serial.println("Nextion interface initialized.");
 
   CanInterface::init();
+  DiagnosticService::init(); // UDS read data by identifier on 0x6F8, answers on 0x6F9
 
   RevLights::init();
   NextionInterface::switchToDriver();
 
-  timer.begin(shifterCallback, 20000); // 20,000 microseconds = 20 milliseconds = 50 Hz
+  CanTxSchedule::begin(); // paddles 50Hz, buttons 20Hz, heartbeat 10Hz
 }
 
 void loop() {
+  CanTxSchedule::task(); // first, its jitter is however long the rest of loop() takes
   CanInterface::task();
+  DiagnosticService::task();
+  NextionInterface::task();
+  Trace::task(); // last, it only gets what USB can take right now
 }
 
 void buttonsCallback() {
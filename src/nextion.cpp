@@ -1,95 +1,660 @@
 #include "nextion.h"
 
+#include "nextion_command.h"
+#include "nextion_parser.h"
+#include "nextion_tft.h"
+#include "trace.h"
+
+#include <inttypes.h>
+
 page NextionInterface::current_page = page::LOADING;
 
-uint8_t NextionInterface::waterTemp = 1;
-uint8_t NextionInterface::oilTemp = 1;
-uint16_t NextionInterface::oilPressure = 1;
-float NextionInterface::batteryVoltage = -1;
-uint16_t NextionInterface::engineRPM = 1;
-float NextionInterface::lambda = -1;
 char NextionInterface::gear = '?';
 
-uint16_t NextionInterface::currentMessage = 0;
+NextionInterface::linkStats NextionInterface::link = {};
+
+#define NEXTION_WIDGET_BINDING(name, component, page, format, decimals, quantum, suffix, initial, bands, priority, minInterval, maxStale) \
+    { component, sizeof(component) - 1, page, format, decimals, quantum, suffix, sizeof(suffix) - 1, bands, { priority, minInterval, maxStale } },
+#define NEXTION_WIDGET_INITIAL(name, component, page, format, decimals, quantum, suffix, initial, ...) initial,
+#define NEXTION_WIDGET_UNKNOWN(name, ...) BAND_UNKNOWN,
+
+const NextionInterface::widget NextionInterface::widgets[FIELD_COUNT] = {
+    NEXTION_WIDGETS(NEXTION_WIDGET_BINDING)
+};
+
+int32_t NextionInterface::values[FIELD_COUNT] = {
+    NEXTION_WIDGETS(NEXTION_WIDGET_INITIAL)
+};
+
+NextionInterface::colourBand NextionInterface::bands[FIELD_COUNT] = {
+    NEXTION_WIDGETS(NEXTION_WIDGET_UNKNOWN)
+};
+
+NextionInterface::colourBand NextionInterface::sentBands[FIELD_COUNT] = {
+    NEXTION_WIDGETS(NEXTION_WIDGET_UNKNOWN)
+};
+
+#undef NEXTION_WIDGET_BINDING
+#undef NEXTION_WIDGET_INITIAL
+#undef NEXTION_WIDGET_UNKNOWN
+
+// what each widget format writes to
+#define NEXTION_ATTRIBUTE_NUMBER "txt"
+#define NEXTION_ATTRIBUTE_FAHRENHEIT "txt"
+#define NEXTION_ATTRIBUTE_CHARACTER "txt"
+#define NEXTION_ATTRIBUTE_VALUE "val"
+#define NEXTION_ATTRIBUTE_VALUE_FAHRENHEIT "val"
+// ctof() adds 32, not 32 * 10^decimals
+#define NEXTION_CELSIUS_NUMBER 0
+#define NEXTION_CELSIUS_FAHRENHEIT 1
+#define NEXTION_CELSIUS_CHARACTER 0
+#define NEXTION_CELSIUS_VALUE 0
+#define NEXTION_CELSIUS_VALUE_FAHRENHEIT 1
+
+// every binding has to be a component on its page in the display project, see tools/nextion_tft.py
+#define NEXTION_WIDGET_CHECK(name, component, page, format, decimals, quantum, suffix, ...) \
+    static_assert(NextionTft::hasAttribute(#page, component, NEXTION_ATTRIBUTE_##format), \
+        "no " #page " " component "." NEXTION_ATTRIBUTE_##format " in tools/nextion_manifest.json"); \
+    static_assert(NEXTION_ATTRIBUTE_##format[0] == 't' || sizeof(suffix) == 1, component ".val can't have a suffix"); \
+    static_assert(!NEXTION_CELSIUS_##format || decimals == 0, component " is converted to Fahrenheit in whole degrees");
+
+NEXTION_WIDGETS(NEXTION_WIDGET_CHECK)
+
+#undef NEXTION_WIDGET_CHECK
+#undef NEXTION_ATTRIBUTE_NUMBER
+#undef NEXTION_ATTRIBUTE_FAHRENHEIT
+#undef NEXTION_ATTRIBUTE_CHARACTER
+#undef NEXTION_ATTRIBUTE_VALUE
+#undef NEXTION_ATTRIBUTE_VALUE_FAHRENHEIT
+#undef NEXTION_CELSIUS_NUMBER
+#undef NEXTION_CELSIUS_FAHRENHEIT
+#undef NEXTION_CELSIUS_CHARACTER
+#undef NEXTION_CELSIUS_VALUE
+#undef NEXTION_CELSIUS_VALUE_FAHRENHEIT
+
+// indexed by colourBand
+const uint16_t NextionInterface::bandColours[] = { RGB565_GREEN, RGB565_ORANGE, RGB565_RED };
+
+uint32_t NextionInterface::lastSent[FIELD_COUNT];
+uint32_t NextionInterface::dirtySince[FIELD_COUNT];
+
+uint16_t NextionInterface::dirty = 0;
+uint16_t NextionInterface::known = 0;
+uint32_t NextionInterface::lastRender = 0;
+uint8_t NextionInterface::batch[BATCH_SIZE];
+uint16_t NextionInterface::batchLength = 0;
+uint16_t NextionInterface::batchMessages = 0;
+
+uint8_t NextionInterface::ring[RING_SIZE];
+uint16_t NextionInterface::ringHead = 0;
+uint16_t NextionInterface::ringTail = 0;
+
+uint8_t NextionInterface::batchTags[MAX_BATCH_MESSAGES];
+NextionInterface::pendingCommand NextionInterface::inFlight[IN_FLIGHT_SIZE];
+uint8_t NextionInterface::inFlightHead = 0;
+uint8_t NextionInterface::inFlightTail = 0;
+NextionInterface::commandStats NextionInterface::commands[TAG_COUNT] = {};
+uint32_t NextionInterface::lastSync = 0;
+
+uint8_t NextionInterface::throttle = 0;
+bool NextionInterface::paused = false;
+uint32_t NextionInterface::pausedAt = 0;
+uint32_t NextionInterface::lastOverflow = 0;
+
+uint8_t NextionInterface::rxBuffer[RX_BUFFER_SIZE];
+NextionParser NextionInterface::parser(NextionInterface::onMessage);
+NextionInterface::touchHandler NextionInterface::touchCallback = nullptr;
+NextionInterface::pageHandler NextionInterface::pageCallback = nullptr;
+
+// fastest first, the display powers up at 9600 so that one always has to be last
+const uint32_t NextionInterface::baudRates[] = { 921600, 512000, 250000, 115200, 9600 };
 
 bool NextionInterface::neutral = false;
 
 NextionInterface::NextionInterface() {}
 
 void NextionInterface::init() {
-    Serial2.begin(9600);
-    delay(200);
     Serial.println("Nextion Setup");
+    // a full batch answered with bkcmd=3 is more than the 64 bytes the UART keeps by itself
+    Serial2.addMemoryForRead(rxBuffer, RX_BUFFER_SIZE);
+    negotiateBaud();
+    Serial.printf("Nextion link at %" PRIu32 " baud, %" PRIu32 " bytes/s\n", link.baud, link.baud / 10);
+    // answer every command, 0x01 or the error, so receive() can tell which one failed
+    sendNextionMessage("bkcmd=3", TAG_UNTRACKED);
     switchToLoading();
 }
 
-short NextionInterface::ctof(short celsius) {
-    return (celsius * 9 / 5) + 32;
+/*
+9600 baud is under a kilobyte a second, a single text update is about 30ms on the wire.
+Find the rate the display is at now (9600 after power up, but it keeps a higher one across a
+reset of ours), then step it up with baud= and keep the first rate it still answers sendme at.
+baud= isn't saved on the display, a power cycle puts it back at 9600.
+*/
+void NextionInterface::negotiateBaud() {
+    uint32_t current = findBaud();
+    if (current == 0) {
+        // no answer at any rate, the display may still be booting. 9600 is where it'll end up
+        Serial.println("Nextion not answering, staying at 9600 baud");
+        Serial2.begin(9600);
+        link.baud = 9600;
+        return;
+    }
+
+    for (uint32_t target : baudRates) {
+        if (target <= current) {
+            break;
+        }
+        NextionCommand command = nextCommand();
+        command.text("baud=").integer(target);
+        queueCommand(command, TAG_UNTRACKED);
+        flush();
+        drainAll(); // the command has to be out before we switch
+
+        Serial2.begin(target);
+        delay(BAUD_SETTLE_MS);
+        if (probe()) {
+            current = target;
+            break;
+        }
+
+        // no answer, but it probably did switch. tell it to go back at the rate it should be at
+        NextionCommand back = nextCommand();
+        back.text("baud=").integer(current);
+        queueCommand(back, TAG_UNTRACKED);
+        flush();
+        drainAll();
+
+        // it may or may not have listened, look for it again before the next try
+        current = findBaud();
+        if (current == 0) {
+            Serial2.begin(9600);
+            current = 9600;
+            break;
+        }
+    }
+    link.baud = current;
+}
+
+// the rate the display answers at, 0 if none
+uint32_t NextionInterface::findBaud() {
+    for (uint32_t rate : baudRates) {
+        Serial2.begin(rate);
+        delay(BAUD_SETTLE_MS);
+        if (probe()) {
+            return rate;
+        }
+    }
+    return 0;
 }
 
-void NextionInterface::sendNextionMessage(String message) {
-    Serial.println(message);
-    Serial2.print(message);
+// sendme answers 0x66 <page> 0xFF 0xFF 0xFF whatever bkcmd is set to
+bool NextionInterface::probe() {
+    // terminate whatever half command the display got at the wrong rate
     Serial2.write(0xFF);
     Serial2.write(0xFF);
     Serial2.write(0xFF);
+    while (Serial2.available()) {
+        Serial2.read();
+    }
+    sendNextionMessage("sendme", TAG_UNTRACKED);
+    drainAll();
+
+    uint8_t reply[5];
+    uint8_t received = 0;
+    uint32_t start = millis();
+    while (millis() - start < PROBE_TIMEOUT_MS) {
+        if (!Serial2.available()) {
+            continue;
+        }
+        uint8_t b = Serial2.read();
+        if (received == 0 && b != 0x66) {
+            continue;
+        }
+        reply[received++] = b;
+        if (received == 5) {
+            if (reply[2] == 0xFF && reply[3] == 0xFF && reply[4] == 0xFF) {
+                return true;
+            }
+            received = 0;
+        }
+    }
+    return false;
 }
 
-void NextionInterface::setWaterTemp(int value) {
-    if(value != waterTemp){
-        waterTemp = value;
+short NextionInterface::ctof(short celsius) {
+    return (celsius * 9 / 5) + 32;
+}
 
-        String instruction = "watertempvalue.txt=\"" + String(ctof(value), DEC) + " " + char(176) + "F\"";
-        sendNextionMessage(instruction);
+// page changes and other one-offs go out straight away, in front of anything still dirty
+void NextionInterface::sendNextionMessage(const char *message, uint8_t tag) {
+    NextionCommand command = nextCommand();
+    command.text(message, strlen(message));
+    queueCommand(command, tag);
+    flush();
+}
+
+// formats straight into the batch, leaving room for the terminator
+NextionCommand NextionInterface::nextCommand() {
+    uint16_t room = BATCH_SIZE - batchLength;
+    return NextionCommand(batch + batchLength, room > 3 ? room - 3 : 0);
+}
+
+bool NextionInterface::queueCommand(const NextionCommand &command, uint8_t tag) {
+    if (!command.ok() || batchMessages == MAX_BATCH_MESSAGES) {
+        return false;
     }
+    batchLength += command.size();
+    batch[batchLength++] = 0xFF;
+    batch[batchLength++] = 0xFF;
+    batch[batchLength++] = 0xFF;
+    batchTags[batchMessages++] = tag;
+    return true;
 }
 
-void NextionInterface::setOilTemp(uint8_t value) {
-    if(value != oilTemp){
-        oilTemp = value;
+// moves the batch to the output ring, drain() takes it from there
+void NextionInterface::flush() {
+    if (batchLength == 0) {
+        return;
+    }
+    if (batchLength > ringFree()) {
+        // only one-off commands can get here, render() never queues more than fits
+        link.dropped += batchMessages;
+    } else {
+        for (uint16_t i = 0; i < batchLength; i++) {
+            ring[(ringHead + i) & (RING_SIZE - 1)] = batch[i];
+        }
+        ringHead += batchLength;
+        link.messages += batchMessages;
+        link.bytes += batchLength;
+
+        // the display answers in order, so the answers are matched to these in order
+        uint32_t now = millis();
+        for (uint16_t i = 0; i < batchMessages; i++) {
+            if (batchTags[i] == TAG_UNTRACKED) {
+                continue;
+            }
+            if ((uint8_t)(inFlightHead - inFlightTail) == IN_FLIGHT_SIZE) {
+                // nothing has come back for a while, give up on the oldest
+                inFlightTail++;
+                link.unanswered++;
+            }
+            inFlight[inFlightHead++ & (IN_FLIGHT_SIZE - 1)] = { batchTags[i], now };
+        }
+    }
+    batchLength = 0;
+    batchMessages = 0;
+}
 
-        String instruction = "oiltempvalue.txt=\"" + String(ctof(value), DEC) + " " + char(176) + "F\"";
-        sendNextionMessage(instruction);
+/*
+Serial2.write() blocks once the UART buffer is full, and at 9600 baud that is a long wait.
+Everything for the display goes through our own ring instead and is handed over only as fast
+as availableForWrite() says it can be taken, so the loop never waits on the display.
+*/
+void NextionInterface::drain() {
+    if (paused) {
+        return;
+    }
+    while (ringHead != ringTail) {
+        int room = Serial2.availableForWrite();
+        if (room <= 0) {
+            return;
+        }
+        uint16_t start = ringTail & (RING_SIZE - 1);
+        uint16_t contiguous = min((uint16_t)(ringHead - ringTail), (uint16_t)(RING_SIZE - start));
+        uint16_t n = min(contiguous, (uint16_t)room);
+        Serial2.write(ring + start, n);
+        ringTail += n;
     }
 }
 
-void NextionInterface::setOilPressure(uint8_t value, uint8_t value2) {
-    uint16_t newOilPressure = (((static_cast<uint16_t>(value2)) | (static_cast<uint16_t>(value) << 8)) * 0.0145);
-    // get one decimal of precision
-    if(oilPressure != newOilPressure){
-        Serial.printf("value: 0x%X 0x%X\n", value, value2);
-        oilPressure = newOilPressure;
-        String instruction = "oilpressvalue.txt=\"" + static_cast<String>(oilPressure) + " PSI\"";
-        sendNextionMessage(instruction);
+/*
+bkcmd=3 makes the display answer every command with 0x01 or an error code, in the order the
+commands went out, so each answer belongs to the oldest command still in flight. Touch and page
+events come in between and are told apart by their code.
+Two commands run together by a garbled terminator get one answer between them, which would
+put every answer after it on the wrong command. A sendme goes out every SYNC_INTERVAL_MS, and
+its 0x66 answer lines the queue up again.
+Only what is already in the UART is read, a byte at a time through the parser, so this never
+waits either.
+*/
+void NextionInterface::receive() {
+    for (uint8_t i = 0; i < RX_PER_TASK && Serial2.available() > 0; i++) {
+        parser.feed(Serial2.read());
     }
 }
 
-void NextionInterface::setVoltage(float value) {
-    if (value != batteryVoltage) {
-        batteryVoltage = value;
-        batteryVoltage = value;
+void NextionInterface::onMessage(const uint8_t *message, uint8_t length) {
+    switch (message[0]) {
+        case 0x65:
+            if (touchCallback) {
+                touchCallback(message[1], message[2], message[3] != 0);
+            }
+            break;
+        case 0x66:
+            resync();
+            if (pageCallback) {
+                pageCallback(message[1]);
+            }
+            break;
+        case 0x24:
+            onOverflow();
+            break;
+        case 0x00:
+            // 00 00 00 is the display starting up, a single 00 is an invalid instruction
+            if (length == 1) {
+                acknowledge(message[0]);
+            }
+            break;
+        default:
+            // 0x01 is success, everything up to 0x23 is an error code for one command.
+            // touch coordinates, sleep and wake, and data from get aren't used
+            if (message[0] <= 0x23 && length == 1) {
+                acknowledge(message[0]);
+            }
+            break;
+    }
+}
 
-        String instruction = "voltvalue.txt=\"" + String(value, 1) + " V\"";
-        sendNextionMessage(instruction);
+void NextionInterface::acknowledge(uint8_t code) {
+    uint32_t now = millis();
+    // a command the display never saw (garbled on the wire, or lost to an overflow) would shift
+    // every answer after it onto the wrong command, so old ones are given up on first
+    while (inFlightHead != inFlightTail && now - inFlight[inFlightTail & (IN_FLIGHT_SIZE - 1)].sent > ACK_TIMEOUT_MS) {
+        inFlightTail++;
+        link.unanswered++;
+    }
+    if (inFlightHead == inFlightTail || inFlight[inFlightTail & (IN_FLIGHT_SIZE - 1)].tag == TAG_SYNC) {
+        // the answer to bkcmd=3 itself, or one for a command we already gave up on
+        return;
     }
+    commandStats &stats = commands[inFlight[inFlightTail++ & (IN_FLIGHT_SIZE - 1)].tag];
+    if (code == 0x01) {
+        stats.ok++;
+        return;
+    }
+    stats.failed++;
+    stats.lastError = code;
+    link.failed++;
+    LOG_WARN(DISPLAY_FAILED, &stats - commands, code);
 }
 
-void NextionInterface::setDriverMessage(uint16_t value) {
-    if(value != currentMessage) {
-        currentMessage = value;
+// everything in front of the oldest sendme should have been answered by now
+void NextionInterface::resync() {
+    uint8_t i = inFlightTail;
+    while (i != inFlightHead && inFlight[i & (IN_FLIGHT_SIZE - 1)].tag != TAG_SYNC) {
+        i++;
+    }
+    if (i == inFlightHead) {
+        // one of ours from init, or the display sending it on its own
+        return;
+    }
+    link.unanswered += (uint8_t)(i - inFlightTail);
+    inFlightTail = i + 1;
+}
 
-        String instruction = "MessageDriver.txt=\"" + String(value, 1) + "\"";
-        sendNextionMessage(instruction);
+/*
+0x24 means the display's own input buffer overflowed and it threw away part of what we sent,
+so the link is faster than the display can take commands right now. Nothing goes out for a
+moment, each overflow halves the render budget (up to MAX_THROTTLE times, won back one step at
+a time while it stays quiet), and every field is sent again since we can't tell which were lost.
+*/
+void NextionInterface::onOverflow() {
+    uint32_t now = millis();
+    link.overflows++;
+    paused = true;
+    pausedAt = now;
+    lastOverflow = now;
+    if (throttle < MAX_THROTTLE) {
+        throttle++;
+    }
+    LOG_WARN(DISPLAY_OVERFLOW, throttle);
+    // their answers won't come
+    link.unanswered += (uint8_t)(inFlightHead - inFlightTail);
+    inFlightTail = inFlightHead;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        if (known & (1 << f)) {
+            markDirty((field)f);
+        }
+        sentBands[f] = BAND_UNKNOWN;
     }
 }
-void NextionInterface::setRPM(uint16_t value) {
-    if(value != engineRPM){
-        engineRPM = value;
-        int roundedValue = (value / 100)*100;
 
-        String instruction = "rpm.txt=\"" + String(roundedValue, DEC) + "\"";
-        sendNextionMessage(instruction);
-    }   
+// startup only, when waiting is fine
+void NextionInterface::drainAll() {
+    while (ringHead != ringTail) {
+        drain();
+    }
+    Serial2.flush();
+}
+
+uint16_t NextionInterface::ringFree() {
+    return RING_SIZE - (uint16_t)(ringHead - ringTail);
+}
+
+void NextionInterface::markDirty(field f) {
+    if (!(dirty & (1 << f))) {
+        dirtySince[f] = millis();
+    }
+    dirty |= 1 << f;
+}
+
+/*
+Setters only store the value and mark the field, the render tick formats whatever changed
+since the last one into a single buffer and writes it in one go. A field that changes ten
+times between two ticks costs one command, and the CAN callbacks never wait on Serial2.
+Each tick only gets as many bytes as the link moves in a tick, handed out by each widget's schedule, so
+a chatty channel can't push the gear out of the way.
+*/
+void NextionInterface::task() {
+    receive();
+
+    uint32_t now = millis();
+    if (paused && now - pausedAt >= THROTTLE_MS) {
+        paused = false;
+    }
+    if (throttle > 0 && now - lastOverflow >= THROTTLE_RECOVER_MS) {
+        throttle--;
+        lastOverflow = now;
+    }
+    if (now - lastSync >= SYNC_INTERVAL_MS) {
+        lastSync = now;
+        sendNextionMessage("sendme", TAG_SYNC);
+    }
+    drain();
+
+    if (now - lastRender < RENDER_INTERVAL_MS) {
+        return;
+    }
+    lastRender = now;
+    render();
+    drain();
+}
+
+void NextionInterface::render() {
+    // fields on the other pages stay dirty until theirs is showing
+    uint16_t candidates = 0;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        if (widgets[f].shownOn == current_page) {
+            candidates |= dirty & (1 << f);
+        }
+    }
+    if (candidates == 0 || paused) {
+        return;
+    }
+    uint32_t now = millis();
+    uint16_t budget = tickBudget();
+    if (budget == 0) {
+        return;
+    }
+    int8_t f;
+    while ((f = nextField(candidates, now)) >= 0) {
+        candidates &= ~(1 << f);
+
+        uint16_t start = batchLength;
+        uint16_t startMessages = batchMessages;
+        NextionCommand command = nextCommand();
+        formatField((field)f, command);
+        bool queued = queueCommand(command, f);
+        // a colour change goes right behind its value, or not at all
+        bool recolour = bands[f] != sentBands[f];
+        if (queued && recolour) {
+            NextionCommand colour = nextCommand();
+            formatColour((field)f, colour);
+            queued = queueCommand(colour, f);
+        }
+        // over budget or a full batch, the rest stays dirty for the next tick. the first
+        // field always goes, otherwise a slow link would never send the long ones
+        if (!queued || (startMessages > 0 && batchLength > budget)) {
+            batchLength = start;
+            batchMessages = startMessages;
+            break;
+        }
+        dirty &= ~(1 << f);
+        lastSent[f] = now;
+        sentBands[f] = bands[f];
+    }
+    flush();
+}
+
+// the dirty field that should go next, -1 if none may go this tick
+int8_t NextionInterface::nextField(uint16_t candidates, uint32_t now) {
+    int8_t best = -1;
+    bool bestStale = false;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        const fieldSchedule &schedule = widgets[f].schedule;
+        if (!(candidates & (1 << f)) || now - lastSent[f] < schedule.minInterval) {
+            continue;
+        }
+        bool stale = now - dirtySince[f] >= schedule.maxStale;
+        if (best < 0 || stale > bestStale || (stale == bestStale && schedule.priority > widgets[best].schedule.priority)) {
+            best = f;
+            bestStale = stale;
+        }
+    }
+    return best;
+}
+
+// what the link moves in one render tick (10 bits a byte), and no more than the ring can take
+// while keeping room for page changes. a backed up ring leaves the fields dirty, so they merge
+uint16_t NextionInterface::tickBudget() {
+    uint32_t bytes = (link.baud / 10 * RENDER_INTERVAL_MS / 1000) >> throttle;
+    uint16_t free = ringFree();
+    uint16_t ringRoom = free > RING_RESERVE ? free - RING_RESERVE : 0;
+    return min(min(bytes, (uint32_t)BATCH_SIZE), (uint32_t)ringRoom);
+}
+
+// component.txt="<value><suffix>", or component.val=<value> for the VALUE formats
+void NextionInterface::formatField(field f, NextionCommand &command) {
+    const widget &w = widgets[f];
+    command.text(w.component, w.componentLength);
+    switch (w.format) {
+        case VALUE:
+            command.text(".val=").integer(values[f]);
+            return;
+        case VALUE_FAHRENHEIT:
+            command.text(".val=").integer(ctof(values[f]));
+            return;
+        default:
+            break;
+    }
+    command.text(".txt=\"");
+    switch (w.format) {
+        case FAHRENHEIT:
+            command.integer(ctof(values[f]));
+            break;
+        case CHARACTER:
+            command.character(values[f]);
+            break;
+        default:
+            command.fixed(values[f], w.decimals);
+            break;
+    }
+    command.text(w.suffix, w.suffixLength).character('"');
+}
+
+// component.pco=<colour>
+void NextionInterface::formatColour(field f, NextionCommand &command) {
+    const widget &w = widgets[f];
+    command.text(w.component, w.componentLength).text(".pco=").integer(bandColours[bands[f]]);
+}
+
+/*
+The one place values change. Rounds down to the widget's quantum and only marks the field if
+that changed what the display would show, returns whether it did. The first value always
+counts, whatever the initial one was.
+*/
+bool NextionInterface::update(field f, int32_t value) {
+    uint16_t quantum = widgets[f].quantum;
+    if (quantum > 1) {
+        value = value / quantum * quantum;
+    }
+    if (value == values[f] && (known & (1 << f))) {
+        return false;
+    }
+    values[f] = value;
+    known |= 1 << f;
+    if (widgets[f].bands.enabled) {
+        bands[f] = nextBand(f, value);
+    }
+    markDirty(f);
+    return true;
+}
+
+// a worse band is entered at its limit, a better one only once the value is clear of it
+NextionInterface::colourBand NextionInterface::nextBand(field f, int32_t value) {
+    const colourBands &limits = widgets[f].bands;
+    colourBand band = classify(limits, value, 0);
+    if (bands[f] == BAND_UNKNOWN || band >= bands[f]) {
+        return band;
+    }
+    return min(bands[f], classify(limits, value, limits.hysteresis));
+}
+
+// the band value is in with the limits margin closer to it
+NextionInterface::colourBand NextionInterface::classify(const colourBands &limits, int32_t value, uint16_t margin) {
+    if (value - margin <= limits.alarmLow || value + margin >= limits.alarmHigh) {
+        return BAND_ALARM;
+    }
+    if (value - margin <= limits.warnLow || value + margin >= limits.warnHigh) {
+        return BAND_WARN;
+    }
+    return BAND_OK;
+}
+
+// for float sources, rounded to the widget's decimals in double like NextionCommand::decimal()
+bool NextionInterface::updateScaled(field f, float value) {
+    double scale = 1;
+    for (uint8_t i = 0; i < widgets[f].decimals; i++) {
+        scale *= 10;
+    }
+    return update(f, lround(value * scale));
+}
+
+void NextionInterface::setWaterTemp(int value) {
+    update(WATER_TEMP, value);
+}
+
+void NextionInterface::setOilTemp(uint8_t value) {
+    update(OIL_TEMP, value);
+}
+
+void NextionInterface::setOilPressure(uint8_t value, uint8_t value2) {
+    uint16_t newOilPressure = (((static_cast<uint16_t>(value2)) | (static_cast<uint16_t>(value) << 8)) * 0.0145);
+    if (update(OIL_PRESSURE, newOilPressure)) {
+        LOG_DEBUG(OIL_PRESSURE_RAW, value, value2, newOilPressure);
+    }
+}
+
+void NextionInterface::setVoltage(float value) {
+    updateScaled(VOLTAGE, value);
+}
+
+void NextionInterface::setDriverMessage(uint16_t value) {
+    update(DRIVER_MESSAGE, value);
+}
+
+void NextionInterface::setRPM(uint16_t value) {
+    update(RPM, value);
 }
 
 void NextionInterface::setGear(int numGear) {
@@ -103,13 +668,12 @@ void NextionInterface::setGear(int numGear) {
 
     if (newGear != gear) {
         gear = newGear;
-        Serial.println(gear);
-        String instruction = "gear.txt=\"" + String(gear) + '\"';
-        sendNextionMessage(instruction);
+        LOG_DEBUG(GEAR, gear);
+        update(GEAR, neutral ? 'N' : gear);
     }
 }
 
-void NextionInterface::setButtonImage(String elementName, bool value) {
+void NextionInterface::setButtonImage(const char *elementName, bool value) {
     // deprecated function, used to set warning buttons on driver screen
 
     // String instruction = "";
@@ -144,57 +708,136 @@ void NextionInterface::setMessageBool(bool value) {
 }
 
 void NextionInterface::setLambda(float value) {
-    if (value != lambda) {
-        lambda = value;
-        // to give context, these are values from Powertrain
-        // float max = 1.5;
-        // float high = 1.2;
-        // float low = 0.8;
-        // float min = 0.5;
-        Serial.println(lambda);
-        String instruction = "lambdabool.txt=\"" + String(value, 3) + " LA\"";
-        sendNextionMessage(instruction);
+    // to give context, these are values from Powertrain
+    // float max = 1.5;
+    // float high = 1.2;
+    // float low = 0.8;
+    // float min = 0.5;
+    if (updateScaled(LAMBDA, value)) {
+        LOG_DEBUG(LAMBDA, values[LAMBDA]);
     }
 }
 
 void NextionInterface::setNeutral(bool value) {
     if(value != neutral){
         neutral = value;
-        if(value) {
-            sendNextionMessage("gear.txt=\"N\"");
-        }
+        update(GEAR, neutral ? 'N' : gear);
     }
 }
 
 /*
-The following switch the pages of the screen, fil in each of them
-The first is given as an example
+The page names are the ones in the display project, see tools/nextion_manifest.json. values[]
+keeps every field whatever page is showing, and only the showing page's fields are sent.
 */
 
 void NextionInterface::switchToLoading() {
-    if(current_page != page::LOADING){
-        sendNextionMessage("page loading");
-        current_page = page::LOADING;
-    }  
+    switchTo(page::LOADING, NextionTft::PAGE_LOADING);
 }
 
 void NextionInterface::switchToStartUp() {
-    @WARNING
+    switchTo(page::STARTUP, NextionTft::PAGE_STARTUP);
 }
 
 void NextionInterface::switchToDriver() {
-    @WARNING
+    switchTo(page::DRIVER, NextionTft::PAGE_DRIVER);
 }
 
 void NextionInterface::switchToYippee() {
-    @WARNING
+    switchTo(page::YIPPEE, NextionTft::PAGE_YIPPEE);
 }
 
 void NextionInterface::switchToWarning() {
-    @WARNING
+    switchTo(page::WARNING, NextionTft::PAGE_WARNING);
 }
 
+/*
+A page command makes the display load the page fresh from the HMI, text and colours as they
+were drawn in the editor, so every field on it is out of date the moment it arrives. The ones
+that have had a value are marked, their minInterval waived and their colour forgotten, and a
+render goes right away so they share a batch with the page command. A field nothing has set
+yet keeps what the editor drew rather than its initial value. From 115200 baud a tick's budget is the whole
+page, below it the rest follows at what the link moves.
+*/
+void NextionInterface::switchTo(page p, const char *name) {
+    if (current_page == p) {
+        return;
+    }
+    NextionCommand command = nextCommand();
+    command.text("page ").text(name, strlen(name));
+    queueCommand(command, TAG_PAGE);
+    current_page = p;
+
+    uint32_t now = millis();
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        if (widgets[f].shownOn == p && (known & (1 << f))) {
+            markDirty((field)f);
+            lastSent[f] = now - widgets[f].schedule.minInterval;
+            sentBands[f] = BAND_UNKNOWN;
+        }
+    }
+    render();
+    // render() leaves the page command alone if there was nothing to send with it
+    flush();
+}
 
 page NextionInterface::getCurrentPage() {
-    @WARNING
+    return current_page;
+}
+
+uint8_t NextionInterface::getWaterTemp() {
+    return values[WATER_TEMP];
+}
+
+uint8_t NextionInterface::getOilTemp() {
+    return values[OIL_TEMP];
+}
+
+uint16_t NextionInterface::getOilPressure() {
+    return values[OIL_PRESSURE];
+}
+
+float NextionInterface::getVoltage() {
+    return values[VOLTAGE] / 10.0f;
+}
+
+uint16_t NextionInterface::getRPM() {
+    return values[RPM];
+}
+
+float NextionInterface::getLambda() {
+    return values[LAMBDA] / 1000.0f;
+}
+
+char NextionInterface::getGear() {
+    return gear;
+}
+
+bool NextionInterface::getNeutral() {
+    return neutral;
+}
+
+const NextionInterface::linkStats &NextionInterface::getLinkStats() {
+    return link;
+}
+
+void NextionInterface::printLinkStats() {
+    Serial.printf("Nextion %" PRIu32 " baud, %" PRIu32 " messages %" PRIu32 " bytes, dropped %" PRIu32 " failed %" PRIu32
+        " unanswered %" PRIu32 " overflows %" PRIu32 " (throttle %u)\n",
+        link.baud, link.messages, link.bytes, link.dropped, link.failed, link.unanswered, link.overflows, throttle);
+    for (uint8_t t = 0; t < TAG_COUNT; t++) {
+        if (commands[t].failed == 0) {
+            continue;
+        }
+        const char *name = t < FIELD_COUNT ? widgets[t].component : t == TAG_PAGE ? "page" : "other";
+        Serial.printf("  %s ok %" PRIu32 " failed %" PRIu32 " (last 0x%02X)\n", name, commands[t].ok, commands[t].failed,
+            commands[t].lastError);
+    }
+}
+
+void NextionInterface::onTouch(touchHandler handler) {
+    touchCallback = handler;
+}
+
+void NextionInterface::onPage(pageHandler handler) {
+    pageCallback = handler;
 }
\ No newline at end of file
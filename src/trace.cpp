@@ -0,0 +1,84 @@
+#include "trace.h"
+
+#include <inttypes.h>
+
+#define TRACE_EVENT_FORMAT(name, format) format,
+
+const char *const Trace::formats[] = {
+    TRACE_EVENTS(TRACE_EVENT_FORMAT)
+};
+
+#undef TRACE_EVENT_FORMAT
+
+Trace::entry Trace::ring[RING_SIZE];
+volatile uint32_t Trace::head = 0;
+volatile uint32_t Trace::tail = 0;
+volatile uint32_t Trace::droppedRecords = 0;
+
+// the Teensy 4 startup code already has the DWT cycle counter running
+void Trace::record(uint8_t level, TraceEvent event, uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t cycles = ARM_DWT_CYCCNT;
+
+    // claim a slot. an interrupt that records in between makes the exchange fail, try again
+    uint32_t index = head;
+    do {
+        if (index - tail >= RING_SIZE) {
+            __atomic_fetch_add(&droppedRecords, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &index, index + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    entry &e = ring[index & (RING_SIZE - 1)];
+    e.cycles = cycles;
+    e.event = event;
+    e.level = level;
+    e.args[0] = a;
+    e.args[1] = b;
+    e.args[2] = c;
+    e.args[3] = d;
+    __atomic_store_n(&e.sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+/*
+One line per record: the cycle count when it was recorded (600 per microsecond, wraps every
+7 seconds), the level and the formatted event. Stops at a record that is still being written,
+the loop comes back for it.
+*/
+void Trace::task() {
+    static const char levels[] = " EWIDT";
+    static uint32_t reportedDrops = 0;
+
+    while (tail != head) {
+        if (Serial.availableForWrite() < LINE_MAX) {
+            return;
+        }
+        char line[LINE_MAX];
+        int n;
+
+        uint32_t drops = droppedRecords;
+        if (drops != reportedDrops) {
+            n = snprintf(line, sizeof(line), "trace: %" PRIu32 " records dropped\n", drops - reportedDrops);
+            Serial.write((const uint8_t *)line, n);
+            reportedDrops = drops;
+            continue;
+        }
+
+        const entry &e = ring[tail & (RING_SIZE - 1)];
+        if (__atomic_load_n(&e.sequence, __ATOMIC_ACQUIRE) != tail + 1) {
+            return;
+        }
+        n = snprintf(line, sizeof(line), "%10" PRIu32 " %c ", e.cycles, levels[e.level]);
+        n += snprintf(line + n, sizeof(line) - n - 1, formats[(uint8_t)e.event], (unsigned)e.args[0],
+            (unsigned)e.args[1], (unsigned)e.args[2], (unsigned)e.args[3]);
+        n = min(n, (int)sizeof(line) - 2);
+        line[n++] = '\n';
+        Serial.write((const uint8_t *)line, n);
+
+        // the slot can be reused from here on
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t Trace::dropped() {
+    return droppedRecords;
+}
@@ -0,0 +1,219 @@
+#include "tx_schedule.h"
+
+#include "main.h"
+
+#include <inttypes.h>
+
+/*
+The IDs live in can.h and are placeholders until the powertrain DBC has them, begin() doesn't
+start the schedule before they are confirmed.
+Periods are multiples of 10ms and the offsets are 0/3/6 mod 10, so no two entries can ever
+come due on the same tick. begin() re-checks this in case someone edits the table.
+*/
+const CanTxSchedule::entry CanTxSchedule::schedule[] = {
+    // id                          period  offset  builder
+    { CanInterface::SHIFT_ID,      20,     0,      CanTxSchedule::buildShift },     // paddles, 50Hz for the shift cut
+    { CanInterface::BUTTONS_ID,    50,     3,      CanTxSchedule::buildButtons },   // steering wheel buttons, 20Hz
+    { CanInterface::HEARTBEAT_ID,  100,    6,      CanTxSchedule::buildHeartbeat }, // heartbeat, 10Hz
+};
+
+const uint8_t CanTxSchedule::scheduleSize = sizeof(schedule) / sizeof(schedule[0]);
+
+IntervalTimer CanTxSchedule::timer;
+bool CanTxSchedule::running = false;
+bool CanTxSchedule::suspended = false;
+volatile uint32_t CanTxSchedule::tick = 0;
+uint32_t CanTxSchedule::startMicros = 0;
+uint32_t CanTxSchedule::nextDue[MAX_ENTRIES];
+volatile uint8_t CanTxSchedule::due = 0;
+volatile uint32_t CanTxSchedule::planned[MAX_ENTRIES];
+volatile CanTxSchedule::timing CanTxSchedule::timings[MAX_ENTRIES];
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// two periodic entries share a tick at some point iff their offsets are congruent mod gcd(periods)
+bool CanTxSchedule::offsetsCollide(const entry &a, const entry &b) {
+    uint32_t g = gcd(a.period, b.period);
+    return (a.offset % g) == (b.offset % g);
+}
+
+void CanTxSchedule::begin() {
+    static_assert(sizeof(schedule) / sizeof(schedule[0]) <= MAX_ENTRIES, "TX schedule has more entries than MAX_ENTRIES");
+
+    for (uint8_t i = 0; i < scheduleSize; i++) {
+        for (uint8_t j = i + 1; j < scheduleSize; j++) {
+            if (offsetsCollide(schedule[i], schedule[j])) {
+                Serial.printf("TX schedule: 0x%" PRIX32 " and 0x%" PRIX32 " will be sent on the same tick, fix their offsets\n", schedule[i].id, schedule[j].id);
+            }
+        }
+    }
+
+    if (!CanInterface::TX_IDS_CONFIRMED) {
+        Serial.println("TX schedule: IDs not confirmed against the DBC, not sending (see can.h)");
+        return;
+    }
+
+    stop();
+    resetTiming();
+    start();
+}
+
+void CanTxSchedule::start() {
+    tick = 0;
+    due = 0;
+    for (uint8_t i = 0; i < scheduleSize; i++) {
+        nextDue[i] = schedule[i].offset;
+    }
+    startMicros = micros();
+    running = true;
+    timer.begin(onTick, TICK_US);
+}
+
+void CanTxSchedule::stop() {
+    timer.end();
+    running = false;
+    due = 0;
+}
+
+void CanTxSchedule::suspend() {
+    suspended = running;
+    stop();
+}
+
+void CanTxSchedule::resume() {
+    if (suspended) {
+        suspended = false;
+        start();
+    }
+}
+
+uint8_t CanTxSchedule::size() {
+    return scheduleSize;
+}
+
+const CanTxSchedule::entry &CanTxSchedule::getEntry(uint8_t index) {
+    return schedule[index];
+}
+
+CanTxSchedule::timing CanTxSchedule::getTiming(uint8_t index) {
+    timing copy;
+    __disable_irq();
+    copy.sent = timings[index].sent;
+    copy.dropped = timings[index].dropped;
+    copy.lastError = timings[index].lastError;
+    copy.minError = timings[index].minError;
+    copy.maxError = timings[index].maxError;
+    copy.sumAbsError = timings[index].sumAbsError;
+    __enable_irq();
+    return copy;
+}
+
+void CanTxSchedule::resetTiming() {
+    __disable_irq();
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
+        timings[i].sent = 0;
+        timings[i].dropped = 0;
+        timings[i].lastError = 0;
+        timings[i].minError = INT32_MAX;
+        timings[i].maxError = INT32_MIN;
+        timings[i].sumAbsError = 0;
+    }
+    __enable_irq();
+}
+
+void CanTxSchedule::printTiming() {
+    for (uint8_t i = 0; i < scheduleSize; i++) {
+        timing t = getTiming(i);
+        Serial.printf("TX 0x%" PRIX32 " every %ums: sent %" PRIu32 " dropped %" PRIu32 " jitter last %" PRId32 "us min %" PRId32
+            "us max %" PRId32 "us mean %" PRIu32 "us\n",
+            schedule[i].id, schedule[i].period, t.sent, t.dropped, t.lastError,
+            t.sent ? t.minError : 0, t.sent ? t.maxError : 0, t.sent ? t.sumAbsError / t.sent : 0);
+    }
+}
+
+// only marks what is due, see the class comment for why it doesn't write
+void CanTxSchedule::onTick() {
+    uint32_t now = tick;
+
+    for (uint8_t i = 0; i < scheduleSize; i++) {
+        if ((int32_t)(now - nextDue[i]) < 0) {
+            continue;
+        }
+        if (due & (1 << i)) {
+            // task() hasn't sent the last one, a whole period late
+            timings[i].dropped++;
+        }
+        // tick n fires one period after start(), at startMicros + (n + 1) * TICK_US
+        planned[i] = startMicros + (nextDue[i] + 1) * TICK_US;
+        due |= 1 << i;
+
+        // stay on the original grid even if a tick was late
+        nextDue[i] += schedule[i].period;
+    }
+
+    tick = now + 1;
+}
+
+void CanTxSchedule::task() {
+    __disable_irq();
+    uint8_t pending = due;
+    due = 0;
+    __enable_irq();
+
+    for (uint8_t i = 0; pending != 0; i++, pending >>= 1) {
+        if (!(pending & 1)) {
+            continue;
+        }
+        const entry &e = schedule[i];
+        CAN_message_t msg;
+        msg.id = e.id;
+        e.build(msg);
+
+        bool sent = CanInterface::Can0.write(msg) > 0;
+        int32_t error = (int32_t)(micros() - planned[i]);
+
+        __disable_irq();
+        volatile timing &t = timings[i];
+        if (sent) {
+            t.sent++;
+            t.lastError = error;
+            if (error < t.minError) t.minError = error;
+            if (error > t.maxError) t.maxError = error;
+            t.sumAbsError += (error < 0) ? -error : error;
+        } else {
+            t.dropped++;
+        }
+        __enable_irq();
+    }
+}
+
+void CanTxSchedule::buildShift(CAN_message_t &msg) {
+    // buttons are wired to ground with pullups, so LOW means pressed
+    CanInterface::packShift(msg, !digitalRead(shiftUp), !digitalRead(shiftDown), !digitalRead(button3));
+}
+
+void CanTxSchedule::buildButtons(CAN_message_t &msg) {
+    msg.len = 1;
+    msg.buf[0] = (!digitalRead(button3) << 0) |
+                 (!digitalRead(button4) << 1) |
+                 (!digitalRead(button5) << 2) |
+                 (!digitalRead(button6) << 3);
+}
+
+void CanTxSchedule::buildHeartbeat(CAN_message_t &msg) {
+    static uint8_t counter = 0;
+    uint32_t uptime = millis() / 1000;
+
+    msg.len = 4;
+    msg.buf[0] = counter++;
+    msg.buf[1] = CanInterface::canActive;
+    msg.buf[2] = uptime >> 8;
+    msg.buf[3] = uptime;
+}
\ No newline at end of file
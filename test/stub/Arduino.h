@@ -0,0 +1,168 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/*
+Just enough of the Teensy core for the wheel's sources to build and run on the host under
+[env:native]. Header only, so a test is its own test_main.cpp plus the sources it includes.
+
+Time stands still until a test moves it: millis() and micros() read hostMicros, delay() and
+delayMicroseconds() add to it. A HardwareSerial writes to and reads from whatever hostPort the
+test plugs into it, with nothing plugged in it swallows writes and never has anything to read.
+The registers FlexCAN_T4 touches are plain variables, only the parts of the library that don't
+touch the controller are meant to run here.
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef volatile uint32_t vuint32_t;
+typedef volatile uint16_t vuint16_t;
+typedef volatile uint8_t vuint8_t;
+
+#define DEC 10
+#define HEX 16
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LOW 0
+#define HIGH 1
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+template <class A, class B> constexpr auto min(A a, B b) { return a < b ? a : b; }
+template <class A, class B> constexpr auto max(A a, B b) { return a > b ? a : b; }
+
+inline uint32_t hostMicros = 0;
+
+inline uint32_t millis() { return hostMicros / 1000; }
+inline uint32_t micros() { return hostMicros; }
+inline void delay(uint32_t ms) { hostMicros += ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { hostMicros += us; }
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+inline long random(long low, long high) { return low + rand() % (high - low); }
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+#define __disable_irq() ((void)0)
+#define __enable_irq() ((void)0)
+#define noInterrupts() __disable_irq()
+#define interrupts() __enable_irq()
+#define F_CPU_ACTUAL 600000000
+
+// FlexCAN_T4's interrupt ends with asm("dsb"), an assembler macro turns it into nothing here
+__asm__(".macro dsb\n.endm");
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) { return 1; }
+    virtual size_t write(const uint8_t *, size_t n) { return n; }
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    virtual int availableForWrite() { return 0; }
+    template <typename T> size_t print(T) { return 0; }
+    template <typename T> size_t print(T, int) { return 0; }
+    template <typename T> size_t println(T) { return 0; }
+    template <typename T> size_t println(T, int) { return 0; }
+    size_t println() { return 0; }
+    int printf(const char *, ...) { return 0; }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+};
+
+// the other end of a HardwareSerial, or of Serial
+class hostPort {
+public:
+    virtual ~hostPort() {}
+    virtual void begin(uint32_t) {}
+    virtual size_t write(const uint8_t *, size_t n) { return n; }
+    virtual int availableForWrite() { return 64; }
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual void flush() {}
+};
+
+class HardwareSerial : public Stream {
+public:
+    hostPort *port = nullptr;
+
+    void begin(uint32_t baud) { if (port) port->begin(baud); }
+    void end() {}
+    void addMemoryForRead(void *, size_t) {}
+    void clear() {}
+    operator bool() { return true; }
+
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t n) override { return port ? port->write(buf, n) : n; }
+    int availableForWrite() override { return port ? port->availableForWrite() : 64; }
+    int available() override { return port ? port->available() : 0; }
+    int read() override { return port ? port->read() : -1; }
+    void flush() override { if (port) port->flush(); }
+};
+
+// print() and printf() go nowhere, write() goes to the port if one is plugged in (Trace::task())
+class usb_serial_class : public Stream {
+public:
+    hostPort *port = nullptr;
+
+    void begin(uint32_t) {}
+    operator bool() { return true; }
+
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t n) override { return port ? port->write(buf, n) : n; }
+    int availableForWrite() override { return port ? port->availableForWrite() : 64; }
+};
+
+inline usb_serial_class Serial;
+inline HardwareSerial Serial1, Serial2, Serial3;
+
+class String {
+public:
+    String(const char *s = "") : s(s) {}
+    const char *c_str() const { return s; }
+    unsigned int length() const { return strlen(s); }
+
+private:
+    const char *s;
+};
+
+// FlexCAN_T4 and trace.cpp
+inline vuint32_t ARM_DWT_CYCCNT;
+inline vuint32_t CCM_CSCMR2, CCM_CCGR0, CCM_CCGR7;
+inline vuint32_t CORE_PIN0_CONFIG, CORE_PIN1_CONFIG, CORE_PIN3_CONFIG, CORE_PIN4_CONFIG, CORE_PIN22_CONFIG,
+    CORE_PIN23_CONFIG, CORE_PIN29_CONFIG, CORE_PIN30_CONFIG;
+inline vuint32_t IOMUXC_FLEXCAN1_RX_SELECT_INPUT, IOMUXC_FLEXCAN2_RX_SELECT_INPUT,
+    IOMUXC_CANFD_IPP_IND_CANRX_SELECT_INPUT;
+inline vuint32_t IOMUXC_SW_PAD_CTL_PAD_GPIO_EMC_37, IOMUXC_SW_PAD_CTL_PAD_GPIO_EMC_36,
+    IOMUXC_SW_PAD_CTL_PAD_GPIO_AD_B1_09, IOMUXC_SW_PAD_CTL_PAD_GPIO_AD_B1_08,
+    IOMUXC_SW_PAD_CTL_PAD_GPIO_AD_B0_03, IOMUXC_SW_PAD_CTL_PAD_GPIO_AD_B0_02,
+    IOMUXC_SW_PAD_CTL_PAD_GPIO_B0_03, IOMUXC_SW_PAD_CTL_PAD_GPIO_B0_02;
+inline vuint32_t IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_37, IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_36,
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_09, IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B1_08,
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_03, IOMUXC_SW_MUX_CTL_PAD_GPIO_AD_B0_02,
+    IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_03, IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_02;
+#define CCM_CSCMR2_CAN_CLK_SEL(n) ((uint32_t)(((n) & 0x03) << 8))
+#define CCM_CSCMR2_CAN_CLK_PODF(n) ((uint32_t)(((n) & 0x3F) << 2))
+#define CCM_CCGR_ON 3
+#define CCM_CCGR0_LPUART3(n) ((uint32_t)(((n) & 0x03) << 12))
+enum { IRQ_CAN1 = 36, IRQ_CAN2 = 37, IRQ_CAN3 = 154 };
+inline void (*_VectorsRam[176])(void);
+#define NVIC_ENABLE_IRQ(n) ((void)(n))
+#define NVIC_DISABLE_IRQ(n) ((void)(n))
+
+#endif // HOST_ARDUINO_H
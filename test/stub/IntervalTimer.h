@@ -0,0 +1,14 @@
+#ifndef HOST_INTERVALTIMER_H
+#define HOST_INTERVALTIMER_H
+
+#include <Arduino.h>
+
+// never fires on the host, a test calls the callback itself
+class IntervalTimer {
+public:
+    bool begin(void (*)(), uint32_t) { return true; }
+    void end() {}
+    void priority(uint8_t) {}
+};
+
+#endif // HOST_INTERVALTIMER_H
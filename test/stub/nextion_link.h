@@ -0,0 +1,105 @@
+#ifndef HOST_NEXTION_LINK_H
+#define HOST_NEXTION_LINK_H
+
+#include <Arduino.h>
+
+#include <deque>
+
+#include "nextion_emulator.h"
+
+/*
+Serial2 wired to a NextionEmulator the way the car has it: the Teensy UART keeps 64 bytes
+waiting to go out, sends them at 10 bits a byte, and what it sends at a rate the display isn't
+at never makes it into a command. Plug it in with Serial2.port = &link.
+
+Polling the UART costs a microsecond of hostMicros, so the driver's busy waits (probe(),
+drainAll()) end on their own. Whatever is written past availableForWrite() is counted in
+blocked, on the Teensy that write would have waited for the UART.
+*/
+class nextionLink : public hostPort {
+public:
+    static const int TX_FIFO = 64;
+
+    NextionEmulator display;
+    uint32_t baud = 9600; // the Teensy side, set by Serial2.begin()
+    uint64_t written = 0;
+    uint64_t blocked = 0;
+    bool stalled = false; // the UART takes nothing, as if the line were held
+    uint32_t lose = 0; // the next writes never reach the display, as if garbled on the wire
+
+    explicit nextionLink(uint32_t displayBaud = 9600) : display(displayBaud) {}
+
+    void begin(uint32_t rate) override {
+        flush();
+        baud = rate;
+        answers.clear();
+    }
+
+    size_t write(const uint8_t *buf, size_t n) override {
+        int room = availableForWrite();
+        if ((int)n > room) {
+            blocked += n - room;
+        }
+        uint64_t now = hostMicros * 1000ull;
+        uint64_t start = fifoEmptyNs > now ? fifoEmptyNs : now;
+        fifoEmptyNs = start + n * byteNs();
+        written += n;
+        display.advance(hostMicros);
+        if (lose > 0) {
+            lose--;
+        } else if (baud == display.baud()) {
+            display.write(start / 1000, buf, n);
+        }
+        return n;
+    }
+
+    int availableForWrite() override {
+        hostMicros++;
+        if (stalled) {
+            return 0;
+        }
+        uint64_t now = hostMicros * 1000ull;
+        if (fifoEmptyNs <= now) {
+            return TX_FIFO;
+        }
+        uint64_t waiting = (fifoEmptyNs - now + byteNs() - 1) / byteNs();
+        return waiting >= TX_FIFO ? 0 : TX_FIFO - waiting;
+    }
+
+    int available() override {
+        hostMicros++;
+        uint8_t in[64];
+        size_t n;
+        display.advance(hostMicros);
+        while ((n = display.read(hostMicros, in, sizeof(in))) > 0) {
+            if (baud == display.baud()) {
+                answers.insert(answers.end(), in, in + n);
+            }
+        }
+        return answers.size();
+    }
+
+    int read() override {
+        if (answers.empty() && available() == 0) {
+            return -1;
+        }
+        uint8_t b = answers.front();
+        answers.pop_front();
+        return b;
+    }
+
+    // waits until the UART is empty, like HardwareSerial::flush()
+    void flush() override {
+        if (fifoEmptyNs > hostMicros * 1000ull) {
+            hostMicros = (fifoEmptyNs + 999) / 1000;
+        }
+    }
+
+private:
+    uint64_t fifoEmptyNs = 0;
+    std::deque<uint8_t> answers;
+
+    uint64_t byteNs() const { return 10000000000ull / baud; }
+};
+
+#endif // HOST_NEXTION_LINK_H
@@ -0,0 +1,166 @@
+#include <unity.h>
+
+#include <FlexCAN_T4.h>
+
+#include <chrono>
+
+/*
+What struct2queueRx hands a received frame to, in order: the CANStaticListeners in the 4th
+template argument, attached CANListener objects, then mbCallbacks (per-ID handler, mailbox
+handler, onReceive). Frames are fed straight to struct2queueRx, as the interrupt does after
+reading a mailbox, so nothing here touches the controller.
+
+The benchmark runs the same handler both ways and prints ns per frame, it doesn't fail on
+timing.
+*/
+
+static char order[16];
+static uint8_t orderLength;
+static uint32_t counts[4];
+static int lastMailbox;
+
+static void record(char c) {
+    if (orderLength < sizeof(order) - 1) {
+        order[orderLength++] = c;
+        order[orderLength] = 0;
+    }
+}
+
+struct mailboxListener : CANStaticListener {
+    static const uint64_t mailboxes = (1ULL << MB4) | (1ULL << 0); // bit 0 is also the FIFO
+    static void frameHandler(const CAN_message_t &, int mailbox, uint8_t) {
+        counts[0]++;
+        lastMailbox = mailbox;
+        record('s');
+    }
+};
+
+struct generalListener : CANStaticListener {
+    static const bool general = 1;
+    static void frameHandler(const CAN_message_t &, int mailbox, uint8_t) {
+        counts[1]++;
+        lastMailbox = mailbox;
+        record('g');
+    }
+};
+
+struct objectListener : CANListener {
+    bool frameHandler(CAN_message_t &, int, uint8_t) override {
+        counts[2]++;
+        record('o');
+        return true;
+    }
+};
+
+static FlexCAN_T4<CAN2, RX_SIZE_16, TX_SIZE_16, CANStaticListeners<mailboxListener, generalListener>> can;
+
+static void idHandler(const CAN_message_t &) { record('i'); }
+static void mainHandler(const CAN_message_t &) { record('m'); }
+
+static void receive(uint32_t id, FLEXCAN_MAILBOX mb) {
+    CAN_message_t msg;
+    msg.id = id;
+    msg.mb = mb;
+    msg.bus = 2;
+    can.struct2queueRx(msg);
+}
+
+void setUp() {
+    memset(counts, 0, sizeof(counts));
+    orderLength = 0;
+    order[0] = 0;
+}
+
+void tearDown() {}
+
+void test_static_mailbox_filter() {
+    receive(0x100, MB4);
+    TEST_ASSERT_EQUAL(1, counts[0]);
+    TEST_ASSERT_EQUAL(1, counts[1]);
+    receive(0x100, MB5);
+    TEST_ASSERT_EQUAL(1, counts[0]);
+    TEST_ASSERT_EQUAL(2, counts[1]);
+    receive(0x100, FIFO);
+    TEST_ASSERT_EQUAL(2, counts[0]);
+    TEST_ASSERT_EQUAL(3, counts[1]);
+}
+
+void test_general_gets_no_mailbox() {
+    receive(0x100, MB5);
+    TEST_ASSERT_EQUAL(-1, lastMailbox);
+}
+
+void test_dispatch_order() {
+    objectListener object;
+    can.attachObj(&object);
+    object.attachGeneralHandler();
+    can.onReceiveId(0x200, idHandler);
+    can.onReceive(mainHandler);
+
+    receive(0x200, MB4);
+    TEST_ASSERT_EQUAL_STRING("sgoim", order);
+
+    can.detachObj(&object);
+    can.onReceive(nullptr);
+    setUp();
+    receive(0x200, MB5);
+    TEST_ASSERT_EQUAL_STRING("gi", order);
+    TEST_ASSERT_EQUAL(0, counts[2]);
+}
+
+// the same handler as a compile-time listener and as an attached CANListener
+static volatile uint32_t benchFrames;
+
+struct benchStatic : CANStaticListener {
+    static const bool general = 1;
+    static void frameHandler(const CAN_message_t &msg, int, uint8_t) { benchFrames += msg.buf[0]; }
+};
+
+struct benchObject : CANListener {
+    bool frameHandler(CAN_message_t &msg, int, uint8_t) override {
+        benchFrames += msg.buf[0];
+        return true;
+    }
+};
+
+static FlexCAN_T4<CAN1, RX_SIZE_16, TX_SIZE_16, CANStaticListeners<benchStatic>> staticCan;
+static FlexCAN_T4<CAN3, RX_SIZE_16, TX_SIZE_16> objectCan;
+
+template <typename bus> static double nsPerFrame(bus &b, uint32_t frames) {
+    CAN_message_t msg;
+    msg.mb = MB4;
+    msg.buf[0] = 1;
+    benchFrames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; i++) {
+        msg.id = i & 0x7FF;
+        b.struct2queueRx(msg);
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_EQUAL(frames, benchFrames);
+    return ns / frames;
+}
+
+void test_benchmark() {
+    const uint32_t FRAMES = 2000000;
+    benchObject object;
+    objectCan.attachObj(&object);
+    object.attachGeneralHandler();
+
+    double staticNs = nsPerFrame(staticCan, FRAMES);
+    double objectNs = nsPerFrame(objectCan, FRAMES);
+    objectCan.detachObj(&object);
+
+    char line[96];
+    snprintf(line, sizeof(line), "CANStaticListeners %.1f ns/frame, attached CANListener %.1f ns/frame", staticNs, objectNs);
+    TEST_MESSAGE(line);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_static_mailbox_filter);
+    RUN_TEST(test_general_gets_no_mailbox);
+    RUN_TEST(test_dispatch_order);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,239 @@
+#include <unity.h>
+
+#include <FlexCAN_T4.h>
+
+/*
+canfd_bittiming() against the runtime search it replaced, over every clock the Teensy 4 can
+give the CAN FD controller and the bitrates and sample points anyone would ask of it.
+
+oldNominal() and oldFlexdata() are the searches in setBaudRate(config, nominal_choice,
+flexdata_choice, ...) and setBaudRateFD(), loop for loop, with the printing and the register
+writes left out. They keep every hit the way the originals fill results[], and hand back the
+one asked for, choice 1 being what setBaudRate(CANFD_timings_t) used to program.
+*/
+
+static const FLEXCAN_CLOCK CLOCKS[] = { CLK_8MHz, CLK_16MHz, CLK_20MHz, CLK_24MHz, CLK_30MHz, CLK_40MHz, CLK_60MHz, CLK_80MHz };
+static const double NOMINAL[] = { 125000, 250000, 500000, 1000000 };
+static const double FLEXDATA[] = { 1000000, 2000000, 4000000, 5000000, 6000000, 8000000 };
+static const double SAMPLE[] = { 70, 75, 80, 87.5 };
+static const double BUS_LENGTH[] = { 1, 5 };
+
+static const uint32_t MAX_CHOICES = 10; // rows in the originals' results[]
+
+static uint32_t cbt(double prescaler, double propseg, double pseg_1, double pseg_2, double rjw) {
+    uint32_t value = ((uint32_t)(propseg - 1) << 10);
+    value |= ((uint32_t)(pseg_2 - 1) << 0);
+    value |= ((uint32_t)(pseg_1 - 1) << 5);
+    value |= ((uint32_t)(rjw - 1) << 16);
+    value |= ((uint32_t)(prescaler - 1) << 21);
+    return value | (1UL << 31);
+}
+
+static uint32_t fdcbt(double prescaler, double propseg, double pseg_1, double pseg_2, double rjw) {
+    uint32_t value = ((uint32_t)(pseg_2 - 1) << 0);
+    value |= ((uint32_t)(pseg_1 - 1) << 5);
+    value |= ((uint32_t)(propseg - 0) << 10);
+    value |= ((uint32_t)(rjw - 1) << 16);
+    return value | ((uint32_t)(prescaler - 1) << 20);
+}
+
+// the CBT value of choice, 0 if there aren't that many
+static uint32_t oldNominal(const CANFD_timings_t &config, uint32_t choice) {
+    uint32_t result = 0, result_old = 0;
+    uint32_t found[MAX_CHOICES] = { 0 };
+    double baudrate = config.baudrate / 1000, req_smp = config.sample, cpi_clock = config.clock;
+    double ratio = cpi_clock * 1000 / baudrate;
+    double propdelay = (config.propdelay * 2) + (config.bus_length * 10);
+    double propseg, pseg_1, pseg_2, rjw = 16, pseg1 = 32, pseg2 = 32;
+    uint32_t ipt = 2;
+    for (uint32_t prescaler = 1; prescaler < 1024; prescaler++) {
+        double temp = ratio / prescaler;
+        for (double nbt = 8; nbt < 129; nbt++) {
+            if (temp != nbt) {
+                continue;
+            }
+            propseg = ceil(propdelay / 1000 * cpi_clock / prescaler);
+            if (propseg > 64) {
+                continue;
+            }
+            for (double pseg = 1; pseg <= pseg1; pseg++) {
+                if (req_smp != 0) {
+                    pseg_1 = round((nbt * req_smp / 100) - 1 - propseg);
+                    pseg_2 = nbt - 1 - propseg - pseg_1;
+                    if (pseg_2 >= ipt && pseg_2 <= pseg2 && pseg_1 > 0 && pseg_1 <= pseg1) {
+                        result = result_old + 1;
+                        rjw = (pseg_2 <= rjw) ? pseg_2 : rjw;
+                        if (result <= MAX_CHOICES) found[result - 1] = cbt(prescaler, propseg, pseg_1, pseg_2, rjw);
+                    }
+                    if (result == result_old) {
+                        pseg = nbt - 1 - propseg;
+                        if (pseg == 3 && ipt == 2) {
+                            result = result + 1;
+                            if (result <= MAX_CHOICES) found[result - 1] = cbt(prescaler, propseg, 1, 2, 1);
+                        }
+                        if (pseg > (ipt + 1) && pseg <= (pseg1 * 2)) {
+                            if ((uint32_t)pseg % 2 != 0) propseg++;
+                            pseg = (nbt - 1 - propseg) / 2;
+                            result = result + 1;
+                            rjw = (pseg <= rjw) ? pseg : rjw;
+                            if (result <= MAX_CHOICES) found[result - 1] = cbt(prescaler, propseg, pseg, nbt - 1 - propseg - pseg, rjw);
+                        }
+                    }
+                }
+                result_old = result;
+                break;
+            }
+        }
+    }
+    return (choice && choice <= min(result, MAX_CHOICES)) ? found[choice - 1] : 0;
+}
+
+// the FDCBT value of choice and its FDCTRL delay compensation bits, 0 if there aren't that many
+static uint32_t oldFlexdata(const CANFD_timings_t &config, uint32_t choice, uint32_t &tdc) {
+    uint32_t result = 0, result_old = 0;
+    uint32_t found[MAX_CHOICES] = { 0 }, foundTdc[MAX_CHOICES] = { 0 };
+    double baudrate = config.baudrateFD / 1000, req_smp = config.sample, cpi_clock = config.clock;
+    double ratio = cpi_clock * 1000 / baudrate;
+    double propseg, pseg_1, pseg_2, ppsegmin, ppsegmax, rjw = 8, pseg1 = 8, pseg2 = 8;
+    uint32_t tdcen = 0, ipt = 2;
+    for (uint32_t prescaler = 1; prescaler < 1024; prescaler++) {
+        double temp = ratio / prescaler;
+        for (double nbt = 5; nbt < 48; nbt++) {
+            if (temp != nbt) {
+                continue;
+            }
+            propseg = ceil(config.propdelay / 1000 * cpi_clock / prescaler);
+            tdcen = 0;
+            if (propseg >= (nbt - 2)) {
+                ppsegmax = nbt - 3;
+                ppsegmin = nbt - 1 - pseg1 - pseg2;
+                if (ppsegmin < 1) ppsegmin = 1;
+                propseg = round((ppsegmax - ppsegmin) / 2);
+                tdcen = 1;
+            }
+            if (propseg > 32) {
+                continue;
+            }
+            uint32_t delay = tdcen ? (1UL << 15) | ((uint32_t)(cpi_clock / (2 * baudrate / 1000)) << 8) : 0;
+            for (double pseg = 1; pseg <= pseg1; pseg++) {
+                pseg_1 = round((nbt * req_smp / 100) - 1 - propseg);
+                pseg_2 = nbt - 1 - propseg - pseg_1;
+                if (pseg_2 >= ipt && pseg_2 <= pseg2 && pseg_1 > 0 && pseg_1 <= pseg1) {
+                    result = result_old + 1;
+                    rjw = (pseg_2 <= rjw) ? pseg_2 : rjw;
+                    if (result <= MAX_CHOICES) {
+                        found[result - 1] = fdcbt(prescaler, propseg, pseg_1, pseg_2, rjw);
+                        foundTdc[result - 1] = delay;
+                    }
+                }
+                if (result == result_old) {
+                    pseg = nbt - 1 - propseg;
+                    if (pseg == 3 && ipt == 2) {
+                        result = result + 1;
+                        if (result <= MAX_CHOICES) {
+                            found[result - 1] = fdcbt(prescaler, propseg, 1, 2, 1);
+                            foundTdc[result - 1] = delay;
+                        }
+                    }
+                    if (pseg > (ipt + 1) && pseg <= (pseg1 * 2)) {
+                        if ((uint32_t)pseg % 2 != 0) propseg++;
+                        pseg = (nbt - 1 - propseg) / 2;
+                        result++;
+                        rjw = (pseg <= rjw) ? pseg : rjw;
+                        if (result <= MAX_CHOICES) {
+                            found[result - 1] = fdcbt(prescaler, propseg, pseg, pseg, rjw);
+                            foundTdc[result - 1] = delay;
+                        }
+                    }
+                }
+                result_old = result;
+                break;
+            }
+        }
+    }
+    if (!choice || choice > min(result, MAX_CHOICES)) {
+        tdc = 0;
+        return 0;
+    }
+    tdc = foundTdc[choice - 1];
+    return found[choice - 1];
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_matches_runtime_search() {
+    uint32_t configs = 0, solved = 0;
+    for (FLEXCAN_CLOCK clock : CLOCKS) {
+        for (double nominal : NOMINAL) {
+            for (double flexdata : FLEXDATA) {
+                for (double sample : SAMPLE) {
+                    for (double length : BUS_LENGTH) {
+                        CANFD_timings_t config;
+                        config.baudrate = nominal;
+                        config.baudrateFD = flexdata;
+                        config.propdelay = 190;
+                        config.bus_length = length;
+                        config.sample = sample;
+                        config.clock = clock;
+
+                        uint32_t oldCbt = oldNominal(config, 1), oldTdc;
+                        uint32_t oldFdcbt = oldFlexdata(config, 1, oldTdc);
+                        CANFD_bittiming_t timing = canfd_bittiming(config);
+
+                        char what[96];
+                        snprintf(what, sizeof(what), "%u MHz, %.0f/%.0f kbit/s, %.1f%%, %.0f m", clock, nominal / 1000,
+                            flexdata / 1000, sample, length);
+                        configs++;
+                        if (!oldCbt || !oldFdcbt) {
+                            // the old search would have left the controller alone
+                            TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, timing.cbt, what);
+                            continue;
+                        }
+                        solved++;
+                        TEST_ASSERT_EQUAL_UINT32_MESSAGE(oldCbt, timing.cbt, what);
+                        TEST_ASSERT_EQUAL_UINT32_MESSAGE(oldFdcbt, timing.fdcbt, what);
+                        TEST_ASSERT_EQUAL_UINT32_MESSAGE(oldTdc, timing.tdc, what);
+                        TEST_ASSERT_EQUAL_MESSAGE(clock, timing.clock, what);
+                    }
+                }
+            }
+        }
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "%u configs, %u with a timing", configs, solved);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_GREATER_THAN(0, solved);
+}
+
+// the setBaudRate(FLEXCAN_FDRATES) presets, as the static_asserts in FlexCAN_T4FDTimings.tpp have them
+void test_presets() {
+    uint32_t tdc;
+    CANFD_timings_t config;
+    config.baudrate = 1000000;
+    config.propdelay = 190;
+    config.bus_length = 1;
+    config.sample = 70;
+
+    config.baudrateFD = 2000000;
+    config.clock = CLK_24MHz;
+    TEST_ASSERT_EQUAL_HEX32(0x800624A6, oldNominal(config, 1));
+    TEST_ASSERT_EQUAL_HEX32(0x31423, oldFlexdata(config, 1, tdc));
+
+    config.baudrateFD = 4000000;
+    TEST_ASSERT_EQUAL_HEX32(0x10421, oldFlexdata(config, 1, tdc));
+    TEST_ASSERT_EQUAL_HEX32(0x8300, tdc);
+
+    config.baudrateFD = 8000000;
+    config.clock = CLK_40MHz;
+    TEST_ASSERT_EQUAL_HEX32(0x800B3D4B, oldNominal(config, 1));
+    TEST_ASSERT_EQUAL_HEX32(0x401, oldFlexdata(config, 1, tdc));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_runtime_search);
+    RUN_TEST(test_presets);
+    return UNITY_END();
+}
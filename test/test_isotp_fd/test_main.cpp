@@ -0,0 +1,237 @@
+#include <unity.h>
+
+#include <isotp_fd.h>
+
+/*
+isotp_fd on a mock CAN FD bus that hands every frame written straight back to the receiving
+side through ext_outputFD2(), so one instance sends and reassembles. Flow control for a first
+frame is answered from inside write(), the way a fast ECU beats the loop, and TX_DL is the
+mailbox size the bus reports. Frames for the receiving side alone are fed in by hand.
+*/
+
+static const uint32_t ID = 0x7E8;
+static const uint8_t FD_LENGTHS[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64 };
+
+static uint8_t mailboxSize = 64;
+static uint32_t frames;
+static bool badLength;
+static uint8_t blockSize;
+static uint16_t framesInBlock;
+static int32_t refuseFrame; // the bus turns this frame down once, counting from 0
+
+static void flowControl() {
+    CANFD_message_t fc;
+    fc.id = ID;
+    fc.bus = 3;
+    fc.len = 8;
+    fc.buf[0] = 0x30;
+    fc.buf[1] = blockSize;
+    fc.buf[2] = 0;
+    ext_outputFD2(fc);
+}
+
+struct loopbackFdBus : FlexCAN_T4_Base {
+    void flexcan_interrupt() override {}
+    void setBaudRate(uint32_t, FLEXCAN_RXTX) override {}
+    uint64_t events() override { return 0; }
+    int write(const CAN_message_t &) override { return 0; }
+    bool isFD() override { return 1; }
+    uint8_t getBusNumber() override { return 3; }
+    uint8_t getFirstTxBoxSize() override { return mailboxSize; }
+    uint8_t freeTxMailboxes() override { return 1; }
+
+    int write(const CANFD_message_t &msg) override {
+        if ((int32_t)frames == refuseFrame) {
+            refuseFrame = -1;
+            return 0;
+        }
+        frames++;
+        bool valid = false;
+        for (uint8_t n : FD_LENGTHS) {
+            valid |= msg.len == n;
+        }
+        badLength |= !valid || msg.len > mailboxSize;
+
+        CANFD_message_t copy = msg;
+        copy.bus = 3;
+        ext_outputFD2(copy);
+        uint8_t type = msg.buf[0] >> 4;
+        if (type == 1) {
+            framesInBlock = 0;
+            flowControl();
+        } else if (type == 2 && blockSize && ++framesInBlock == blockSize) {
+            framesInBlock = 0;
+            flowControl();
+        }
+        return 1;
+    }
+};
+
+static loopbackFdBus bus;
+static isotp_fd<RX_BANKS_4, 10000> transport;
+static uint8_t payload[10000];
+static uint8_t received[10000];
+static uint32_t receivedLength;
+static uint32_t receptions;
+
+static void onReceive(const ISOTP_data &config, const uint8_t *data) {
+    receptions++;
+    receivedLength = config.len;
+    memcpy(received, data, config.len);
+}
+
+static void send(uint32_t size) {
+    ISOTP_data config;
+    config.id = ID;
+    config.flow_control_id = ID;
+    TEST_ASSERT_TRUE(transport.writeAsync(config, payload, size));
+    uint32_t start = hostMicros;
+    while (transport.writeBusy() && hostMicros - start < 10000000) {
+        transport.events();
+        hostMicros += 50;
+    }
+}
+
+static void expectReceived(uint32_t size) {
+    char what[32];
+    snprintf(what, sizeof(what), "%u bytes at TX_DL %u", size, mailboxSize);
+    TEST_ASSERT_EQUAL_MESSAGE(1, receptions, what);
+    TEST_ASSERT_EQUAL_MESSAGE(size, receivedLength, what);
+    TEST_ASSERT_TRUE_MESSAGE(!memcmp(payload, received, size), what);
+    TEST_ASSERT_FALSE_MESSAGE(badLength, what);
+}
+
+// a frame for the receiving side only
+static void feed(const uint8_t *data, uint8_t len) {
+    CANFD_message_t msg;
+    msg.id = ID;
+    msg.bus = 3;
+    msg.len = len;
+    memset(msg.buf, 0xCC, sizeof(msg.buf));
+    memcpy(msg.buf, data, len);
+    ext_outputFD2(msg);
+}
+
+static void firstFrame(uint16_t size, uint8_t len) {
+    uint8_t frame[64];
+    frame[0] = 0x10 | size >> 8;
+    frame[1] = size;
+    memcpy(frame + 2, payload, len - 2);
+    feed(frame, len);
+}
+
+static void consecutiveFrame(uint8_t sequence, uint32_t offset, uint8_t len) {
+    uint8_t frame[64];
+    frame[0] = 0x20 | (sequence & 0xF);
+    memcpy(frame + 1, payload + offset, len - 1);
+    feed(frame, len);
+}
+
+void setUp() {
+    receptions = 0;
+    receivedLength = 0;
+    frames = 0;
+    badLength = false;
+    blockSize = 0;
+    refuseFrame = -1;
+    mailboxSize = 64;
+    hostMicros += 1000000;
+}
+
+void tearDown() {
+    transport.cancelWrite();
+}
+
+void test_round_trip() {
+    static const uint32_t SIZES[] = { 1, 7, 8, 40, 62, 63, 100, 4095, 4096, 10000 };
+    static const uint8_t MAILBOXES[] = { 8, 16, 64 };
+    for (uint8_t mailbox : MAILBOXES) {
+        for (uint32_t size : SIZES) {
+            setUp();
+            mailboxSize = mailbox;
+            send(size);
+            expectReceived(size);
+        }
+    }
+}
+
+void test_frames_per_transfer() {
+    send(4095);
+    expectReceived(4095);
+    TEST_ASSERT_EQUAL(66, frames); // 62 bytes in the first frame, 63 in each consecutive one
+}
+
+// flow control after every block comes in from inside write()
+void test_blocks_during_write() {
+    blockSize = 4;
+    send(4095);
+    expectReceived(4095);
+}
+
+void test_refused_block_end() {
+    blockSize = 2;
+    refuseFrame = 2; // the first frame, then a block of two
+    send(1000);
+    expectReceived(1000);
+}
+
+// a consecutive frame shorter than the first frame's RX_DL that isn't the last one would
+// advance the sequence number with bytes the sender never sent
+void test_short_consecutive_frame() {
+    firstFrame(200, 64); // 62 bytes, 138 to go
+    consecutiveFrame(1, 62, 8);
+    consecutiveFrame(2, 69, 64);
+    consecutiveFrame(3, 132, 64);
+    consecutiveFrame(4, 195, 8);
+    TEST_ASSERT_EQUAL(0, receptions);
+
+    firstFrame(200, 64);
+    consecutiveFrame(1, 62, 1); // nothing but the PCI byte
+    consecutiveFrame(2, 62, 64);
+    consecutiveFrame(3, 125, 64);
+    consecutiveFrame(4, 188, 16);
+    TEST_ASSERT_EQUAL(0, receptions);
+
+    // the right lengths go through
+    firstFrame(200, 64);
+    consecutiveFrame(1, 62, 64);
+    consecutiveFrame(2, 125, 64);
+    consecutiveFrame(3, 188, 16); // 12 left, padded up to an FD length
+    TEST_ASSERT_EQUAL(1, receptions);
+    TEST_ASSERT_EQUAL(200, receivedLength);
+    TEST_ASSERT_EQUAL_MEMORY(payload, received, 200);
+}
+
+// the last one may be short, but not shorter than what is left
+void test_short_last_frame() {
+    firstFrame(100, 64);
+    consecutiveFrame(1, 62, 32); // 38 left
+    TEST_ASSERT_EQUAL(0, receptions);
+    consecutiveFrame(2, 93, 8);
+    TEST_ASSERT_EQUAL(0, receptions);
+}
+
+void test_undersized_first_frame() {
+    firstFrame(100, 7);
+    consecutiveFrame(1, 5, 8);
+    TEST_ASSERT_EQUAL(0, receptions);
+}
+
+int main() {
+    for (int i = 0; i < 10000; i++) {
+        payload[i] = i * 7 + (i >> 8);
+    }
+    transport.setWriteBus(&bus);
+    transport.begin();
+    transport.onReceive(onReceive);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_frames_per_transfer);
+    RUN_TEST(test_blocks_during_write);
+    RUN_TEST(test_refused_block_end);
+    RUN_TEST(test_short_consecutive_frame);
+    RUN_TEST(test_short_last_frame);
+    RUN_TEST(test_undersized_first_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,270 @@
+#include <unity.h>
+
+#include <isotp.h>
+
+/*
+isotp's writeAsync()/events() against a receiving peer on a loopback bus. Every frame written
+takes 130 us of bus time (8 bytes at 1 Mbit/s), the peer reassembles what it gets and answers
+first frames and full blocks with flow control after fcDelayUs, 0 answers from inside write()
+the way a fast ECU can beat the interrupt back to the loop. Time only moves in the test's
+loop, 20 us per events() call.
+*/
+
+static const uint32_t TX_ID = 0x7E8;
+static const uint32_t FC_ID = 0x7E0;
+static const uint32_t FRAME_US = 130;
+
+struct peer {
+    uint8_t blockSize;
+    uint8_t stmin;
+    uint8_t flowStatus; // 0 clear to send, 1 wait (then clear to send 200 ms later), 2 overflow
+    bool silent;
+    uint32_t fcDelayUs;
+};
+
+static peer remote;
+static uint8_t received[4095];
+static uint16_t receivedLength;
+static uint16_t framesInBlock;
+static uint32_t frames;
+static uint32_t flowControls;
+static int32_t refuseFrame; // the bus turns this frame down once, counting from 0
+static bool fcDue;
+static uint32_t fcAt;
+static uint8_t fcStatus;
+static uint32_t busFreeAt;
+static uint32_t minGapUs; // between two consecutive frames of one block
+static uint32_t lastConsecutiveAt;
+static bool lastWasConsecutive;
+
+static void sendFlowControl() {
+    CAN_message_t fc;
+    fc.id = FC_ID;
+    fc.bus = 1;
+    fc.len = 8;
+    fc.buf[0] = 0x30 | fcStatus;
+    fc.buf[1] = remote.blockSize;
+    fc.buf[2] = remote.stmin;
+    flowControls++;
+    fcDue = false;
+    ext_output2(fc);
+    if (fcStatus == 1) {
+        fcDue = true;
+        fcAt = hostMicros + 200000;
+        fcStatus = 0;
+    }
+}
+
+static void requestFlowControl(uint8_t status) {
+    if (remote.silent) {
+        return;
+    }
+    fcStatus = status;
+    fcDue = true;
+    fcAt = hostMicros + remote.fcDelayUs;
+    if (!remote.fcDelayUs) {
+        sendFlowControl();
+    }
+}
+
+struct loopbackBus : FlexCAN_T4_Base {
+    void flexcan_interrupt() override {}
+    void setBaudRate(uint32_t, FLEXCAN_RXTX) override {}
+    uint64_t events() override { return 0; }
+    int write(const CANFD_message_t &) override { return 0; }
+    bool isFD() override { return 0; }
+    uint8_t getBusNumber() override { return 1; }
+    uint8_t getFirstTxBoxSize() override { return 8; }
+    uint8_t freeTxMailboxes() override { return hostMicros >= busFreeAt; }
+
+    int write(const CAN_message_t &msg) override {
+        if (hostMicros < busFreeAt) {
+            return 0;
+        }
+        if ((int32_t)frames == refuseFrame) {
+            refuseFrame = -1;
+            return 0;
+        }
+        busFreeAt = hostMicros + FRAME_US;
+        frames++;
+        if (msg.id != TX_ID) {
+            return 1;
+        }
+        uint8_t type = msg.buf[0] >> 4;
+        if (type == 0) {
+            receivedLength = msg.buf[0];
+            memcpy(received, &msg.buf[1], receivedLength);
+        } else if (type == 1) {
+            lastWasConsecutive = false;
+            memcpy(received, &msg.buf[2], 6);
+            receivedLength = 6;
+            framesInBlock = 0;
+            requestFlowControl(remote.flowStatus);
+        } else if (type == 2) {
+            if (lastWasConsecutive) {
+                minGapUs = min(minGapUs, hostMicros - lastConsecutiveAt);
+            }
+            lastWasConsecutive = true;
+            lastConsecutiveAt = hostMicros;
+            memcpy(received + receivedLength, &msg.buf[1], msg.len - 1);
+            receivedLength += msg.len - 1;
+            if (remote.blockSize && ++framesInBlock == remote.blockSize) {
+                framesInBlock = 0;
+                lastWasConsecutive = false; // the gap to the next one includes the flow control
+                requestFlowControl(0);
+            }
+        }
+        return 1;
+    }
+};
+
+static loopbackBus bus;
+static isotp<RX_BANKS_2, 16> transport;
+static uint8_t payload[4095];
+static int status;
+static uint32_t doneAt;
+
+static void onDone(const ISOTP_data &, ISOTP_TX_STATUS s) {
+    status = s;
+    doneAt = hostMicros;
+}
+
+// sends size bytes, returns how long it took in us
+static uint32_t transfer(uint16_t size, peer p) {
+    remote = p;
+    receivedLength = 0;
+    frames = flowControls = 0;
+    fcDue = false;
+    minGapUs = UINT32_MAX;
+    lastWasConsecutive = false;
+    status = -1;
+
+    ISOTP_data config;
+    config.id = TX_ID;
+    config.flow_control_id = FC_ID;
+    uint32_t start = hostMicros;
+    TEST_ASSERT_TRUE(transport.writeAsync(config, payload, size, onDone));
+    while (transport.writeBusy() && hostMicros - start < 10000000) {
+        transport.events();
+        if (fcDue && hostMicros >= fcAt) {
+            sendFlowControl();
+        }
+        hostMicros += 20;
+    }
+    return doneAt - start;
+}
+
+static void expectDelivered(uint16_t size) {
+    TEST_ASSERT_EQUAL(ISOTP_TX_DONE, status);
+    TEST_ASSERT_EQUAL(size, receivedLength);
+    TEST_ASSERT_EQUAL_MEMORY(payload, received, size);
+}
+
+static void report(const char *name, uint16_t size, uint32_t us) {
+    char line[96];
+    snprintf(line, sizeof(line), "%s: %u bytes in %u us, %u B/s", name, size, us, (unsigned)(size * 1000000ull / us));
+    TEST_MESSAGE(line);
+}
+
+void setUp() {
+    refuseFrame = -1;
+    hostMicros += 1000000;
+}
+
+void tearDown() {
+    transport.cancelWrite();
+}
+
+void test_single_frame() {
+    transfer(7, { 0, 0, 0, false, 300 });
+    expectDelivered(7);
+    TEST_ASSERT_EQUAL(1, frames);
+    TEST_ASSERT_EQUAL(0, flowControls);
+}
+
+void test_no_block_limit() {
+    uint32_t us = transfer(4095, { 0, 0, 0, false, 300 });
+    expectDelivered(4095);
+    TEST_ASSERT_EQUAL(1, flowControls);
+    report("BS 0 STmin 0", 4095, us);
+}
+
+void test_blocks_of_eight() {
+    uint32_t us = transfer(4095, { 8, 0, 0, false, 300 });
+    expectDelivered(4095);
+    TEST_ASSERT_EQUAL(1 + 584 / 8, flowControls); // 6 + 584 * 7 + 1 bytes, the last block is short
+    report("BS 8 STmin 0", 4095, us);
+}
+
+void test_peer_stmin() {
+    uint32_t us = transfer(500, { 8, 1, 0, false, 300 });
+    expectDelivered(500);
+    TEST_ASSERT_GREATER_OR_EQUAL(1000, minGapUs);
+    report("BS 8 STmin 1 ms", 500, us);
+
+    us = transfer(500, { 0, 0xF5, 0, false, 300 });
+    expectDelivered(500);
+    TEST_ASSERT_GREATER_OR_EQUAL(500, minGapUs);
+    report("BS 0 STmin 500 us", 500, us);
+}
+
+// the peer's flow control comes in while write() is still running, before events() is back
+void test_flow_control_during_write() {
+    transfer(4095, { 8, 0, 0, false, 0 });
+    expectDelivered(4095);
+    TEST_ASSERT_EQUAL(1 + 584 / 8, flowControls);
+}
+
+// a refused write must not leave the transfer waiting for flow control nobody will send
+void test_refused_first_frame() {
+    refuseFrame = 0;
+    transfer(100, { 0, 0, 0, false, 300 });
+    expectDelivered(100);
+    TEST_ASSERT_EQUAL(1, flowControls);
+}
+
+void test_refused_block_end() {
+    refuseFrame = 2; // the first frame, then a block of two
+    transfer(100, { 2, 0, 0, false, 300 });
+    expectDelivered(100);
+    TEST_ASSERT_EQUAL(1 + 13 / 2, flowControls); // 14 consecutive frames, the last answer comes after the end
+}
+
+void test_wait_then_clear_to_send() {
+    uint32_t us = transfer(100, { 8, 0, 1, false, 300 });
+    expectDelivered(100);
+    TEST_ASSERT_GREATER_OR_EQUAL(200000, us);
+}
+
+void test_overflow() {
+    transfer(100, { 8, 0, 2, false, 300 });
+    TEST_ASSERT_EQUAL(ISOTP_TX_OVERFLOW, status);
+    TEST_ASSERT_EQUAL(6, receivedLength);
+}
+
+void test_no_flow_control() {
+    uint32_t us = transfer(100, { 8, 0, 0, true, 300 });
+    TEST_ASSERT_EQUAL(ISOTP_TX_TIMEOUT, status);
+    TEST_ASSERT_GREATER_OR_EQUAL(999000, us); // N_Bs, in whole milliseconds
+}
+
+int main() {
+    for (int i = 0; i < 4095; i++) {
+        payload[i] = i * 13;
+    }
+    transport.setWriteBus(&bus);
+    transport.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_single_frame);
+    RUN_TEST(test_no_block_limit);
+    RUN_TEST(test_blocks_of_eight);
+    RUN_TEST(test_peer_stmin);
+    RUN_TEST(test_flow_control_during_write);
+    RUN_TEST(test_refused_first_frame);
+    RUN_TEST(test_refused_block_end);
+    RUN_TEST(test_wait_then_clear_to_send);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_no_flow_control);
+    return UNITY_END();
+}
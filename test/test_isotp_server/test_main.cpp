@@ -0,0 +1,303 @@
+#include <unity.h>
+
+#include <isotp_server.h>
+
+/*
+isotp_server's events() against a requesting peer on a loopback bus, as test_isotp_flow_control
+does for isotp. The peer asks for a buffer with a single frame on the server's ID, reassembles
+the answer, and sends flow control after first frames and full blocks fcDelayUs later, 0
+answers from inside write(). Requests and flow control go in through ext_output3(), as
+FlexCAN_T4 hands them over. Every frame written takes 130 us of bus time, time only moves in
+the test's loop, 20 us per events() call.
+*/
+
+static const uint32_t SERVER_ID = 0x7E8;
+static const uint32_t REQUEST = 0x022101; // PCI 02, service 21, local id 01
+static const uint32_t OTHER_REQUEST = 0x022102;
+static const uint32_t FRAME_US = 130;
+
+struct peer {
+    uint8_t blockSize;
+    uint8_t stmin;
+    uint8_t flowStatus; // 0 clear to send, 1 wait (then clear to send 200 ms later), 2 overflow
+    bool silent;
+    uint32_t fcDelayUs;
+};
+
+static peer remote;
+static uint8_t received[4095];
+static uint16_t receivedLength;
+static uint16_t expectedLength;
+static uint16_t framesInBlock;
+static uint32_t frames;
+static uint32_t flowControls;
+static int32_t refuseFrame; // the bus turns this frame down once, counting from 0
+static bool fcDue;
+static uint32_t fcAt;
+static uint8_t fcStatus;
+static uint32_t busFreeAt;
+static uint32_t minGapUs; // between two consecutive frames of one block
+static uint32_t lastConsecutiveAt;
+static bool lastWasConsecutive;
+static uint8_t nextSequence;
+static bool sequenceError;
+
+static void receive(const uint8_t *data) {
+    CAN_message_t msg;
+    msg.id = SERVER_ID;
+    msg.bus = 1;
+    msg.len = 8;
+    memcpy(msg.buf, data, 8);
+    ext_output3(msg);
+}
+
+static void sendFlowControl() {
+    uint8_t fc[8] = { (uint8_t)(0x30 | fcStatus), remote.blockSize, remote.stmin, 0, 0, 0, 0, 0 };
+    flowControls++;
+    fcDue = false;
+    receive(fc);
+    if (fcStatus == 1) {
+        fcDue = true;
+        fcAt = hostMicros + 200000;
+        fcStatus = 0;
+    }
+}
+
+static void requestFlowControl(uint8_t status) {
+    if (remote.silent) {
+        return;
+    }
+    fcStatus = status;
+    fcDue = true;
+    fcAt = hostMicros + remote.fcDelayUs;
+    if (!remote.fcDelayUs) {
+        sendFlowControl();
+    }
+}
+
+struct loopbackBus : FlexCAN_T4_Base {
+    void flexcan_interrupt() override {}
+    void setBaudRate(uint32_t, FLEXCAN_RXTX) override {}
+    uint64_t events() override { return 0; }
+    int write(const CANFD_message_t &) override { return 0; }
+    bool isFD() override { return 0; }
+    uint8_t getBusNumber() override { return 1; }
+    uint8_t getFirstTxBoxSize() override { return 8; }
+    uint8_t freeTxMailboxes() override { return hostMicros >= busFreeAt; }
+
+    int write(const CAN_message_t &msg) override {
+        if (hostMicros < busFreeAt) {
+            return 0;
+        }
+        if ((int32_t)frames == refuseFrame) {
+            refuseFrame = -1;
+            return 0;
+        }
+        busFreeAt = hostMicros + FRAME_US;
+        frames++;
+        if (msg.id != SERVER_ID) {
+            return 1;
+        }
+        uint8_t type = msg.buf[0] >> 4;
+        if (type == 0) {
+            expectedLength = receivedLength = msg.buf[0];
+            memcpy(received, &msg.buf[1], receivedLength);
+        } else if (type == 1) {
+            expectedLength = (msg.buf[0] & 0xF) << 8 | msg.buf[1];
+            lastWasConsecutive = false;
+            memcpy(received, &msg.buf[2], 6);
+            receivedLength = 6;
+            framesInBlock = 0;
+            nextSequence = 1;
+            requestFlowControl(remote.flowStatus);
+        } else if (type == 2) {
+            sequenceError |= (msg.buf[0] & 0xF) != (nextSequence++ & 0xF);
+            if (lastWasConsecutive) {
+                minGapUs = min(minGapUs, hostMicros - lastConsecutiveAt);
+            }
+            lastWasConsecutive = true;
+            lastConsecutiveAt = hostMicros;
+            uint16_t n = min(7, expectedLength - receivedLength);
+            memcpy(received + receivedLength, &msg.buf[1], n);
+            receivedLength += n;
+            if (remote.blockSize && ++framesInBlock == remote.blockSize && receivedLength < expectedLength) {
+                framesInBlock = 0;
+                lastWasConsecutive = false; // the gap to the next one includes the flow control
+                requestFlowControl(0);
+            }
+        }
+        return 1;
+    }
+};
+
+static loopbackBus bus;
+static isotp_server<4> server;
+static uint8_t payload[4095];
+static uint8_t otherPayload[20];
+
+// asks for the buffer behind request and runs the server until the answer is in, or for forUs
+// whatever happens if given. returns how long the answer took in us, 0 if it never came
+static uint32_t transfer(uint32_t request, peer p, uint32_t forUs = 0) {
+    remote = p;
+    receivedLength = expectedLength = 0;
+    frames = flowControls = 0;
+    fcDue = false;
+    minGapUs = UINT32_MAX;
+    lastWasConsecutive = false;
+    sequenceError = false;
+
+    uint8_t frame[8] = { (uint8_t)(request >> 16), (uint8_t)(request >> 8), (uint8_t)request, 0, 0, 0, 0, 0 };
+    receive(frame);
+    uint32_t start = hostMicros, doneAt = 0;
+    while (hostMicros - start < (forUs ? forUs : 3000000)) {
+        server.events();
+        if (fcDue && hostMicros >= fcAt) {
+            sendFlowControl();
+        }
+        if (!doneAt && expectedLength && receivedLength == expectedLength) {
+            doneAt = hostMicros;
+            if (!forUs) {
+                break;
+            }
+        }
+        hostMicros += 20;
+    }
+    return doneAt ? doneAt - start : 0;
+}
+
+static void expectDelivered(const uint8_t *data, uint16_t size) {
+    TEST_ASSERT_EQUAL(size, expectedLength);
+    TEST_ASSERT_EQUAL(size, receivedLength);
+    TEST_ASSERT_EQUAL_MEMORY(data, received, size);
+    TEST_ASSERT_FALSE(sequenceError);
+}
+
+static void report(const char *name, uint16_t size, uint32_t us) {
+    char line[96];
+    snprintf(line, sizeof(line), "%s: %u bytes in %u us, %u B/s", name, size, us, (unsigned)(size * 1000000ull / us));
+    TEST_MESSAGE(line);
+}
+
+void setUp() {
+    refuseFrame = -1;
+    hostMicros += 1000000;
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 4095);
+}
+
+void tearDown() {}
+
+void test_single_frame() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 7);
+    transfer(REQUEST, { 0, 0, 0, false, 300 });
+    expectDelivered(payload, 7);
+    TEST_ASSERT_EQUAL(1, frames);
+    TEST_ASSERT_EQUAL(0, flowControls);
+}
+
+void test_no_block_limit() {
+    uint32_t us = transfer(REQUEST, { 0, 0, 0, false, 300 });
+    expectDelivered(payload, 4095);
+    TEST_ASSERT_EQUAL(1, flowControls);
+    report("BS 0 STmin 0", 4095, us);
+}
+
+void test_blocks_of_eight() {
+    uint32_t us = transfer(REQUEST, { 8, 0, 0, false, 300 });
+    expectDelivered(payload, 4095);
+    TEST_ASSERT_EQUAL(1 + 584 / 8, flowControls); // 6 + 584 * 7 + 1 bytes, the last block is short
+    report("BS 8 STmin 0", 4095, us);
+}
+
+void test_peer_stmin() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 500);
+    transfer(REQUEST, { 8, 1, 0, false, 300 });
+    expectDelivered(payload, 500);
+    TEST_ASSERT_GREATER_OR_EQUAL(1000, minGapUs);
+
+    transfer(REQUEST, { 0, 0xF5, 0, false, 300 });
+    expectDelivered(payload, 500);
+    TEST_ASSERT_GREATER_OR_EQUAL(500, minGapUs);
+}
+
+// the peer's flow control comes in while write() is still running, before events() is back
+void test_flow_control_during_write() {
+    transfer(REQUEST, { 8, 0, 0, false, 0 });
+    expectDelivered(payload, 4095);
+    TEST_ASSERT_EQUAL(1 + 584 / 8, flowControls);
+}
+
+// a refused write must not leave the transfer waiting for flow control nobody will send
+void test_refused_first_frame() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 100);
+    refuseFrame = 0;
+    transfer(REQUEST, { 0, 0, 0, false, 300 });
+    expectDelivered(payload, 100);
+    TEST_ASSERT_EQUAL(1, flowControls);
+}
+
+void test_refused_block_end() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 100);
+    refuseFrame = 2; // the first frame, then a block of two
+    transfer(REQUEST, { 2, 0, 0, false, 0 });
+    expectDelivered(payload, 100);
+    TEST_ASSERT_EQUAL(1 + 13 / 2, flowControls); // 14 consecutive frames, none after the last block
+}
+
+void test_wait_then_clear_to_send() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, REQUEST, payload, 100);
+    uint32_t us = transfer(REQUEST, { 8, 0, 1, false, 300 });
+    expectDelivered(payload, 100);
+    TEST_ASSERT_GREATER_OR_EQUAL(200000, us);
+}
+
+void test_overflow() {
+    transfer(REQUEST, { 8, 0, 2, false, 300 }, 100000);
+    TEST_ASSERT_EQUAL(6, receivedLength);
+    TEST_ASSERT_EQUAL(1, frames);
+}
+
+// N_Bs runs out and the server gives up, the next request starts over
+void test_no_flow_control() {
+    transfer(REQUEST, { 8, 0, 0, true, 300 }, 1500000);
+    TEST_ASSERT_EQUAL(6, receivedLength);
+    TEST_ASSERT_EQUAL(1, frames);
+
+    transfer(REQUEST, { 8, 0, 0, false, 300 });
+    expectDelivered(payload, 4095);
+}
+
+void test_two_buffers() {
+    server.addBuffer(SERVER_ID, STANDARD_ID, OTHER_REQUEST, otherPayload, sizeof(otherPayload));
+    transfer(OTHER_REQUEST, { 0, 0, 0, false, 300 });
+    expectDelivered(otherPayload, sizeof(otherPayload));
+    transfer(REQUEST, { 0, 0, 0, false, 300 });
+    expectDelivered(payload, 4095);
+    TEST_ASSERT_TRUE(server.removeBuffer(SERVER_ID, STANDARD_ID, OTHER_REQUEST));
+    transfer(OTHER_REQUEST, { 0, 0, 0, false, 300 }, 100000);
+    TEST_ASSERT_EQUAL(0, frames);
+}
+
+int main() {
+    for (int i = 0; i < 4095; i++) {
+        payload[i] = i * 13;
+    }
+    for (uint8_t i = 0; i < sizeof(otherPayload); i++) {
+        otherPayload[i] = 0xF0 - i;
+    }
+    server.setWriteBus(&bus);
+    server.begin();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_single_frame);
+    RUN_TEST(test_no_block_limit);
+    RUN_TEST(test_blocks_of_eight);
+    RUN_TEST(test_peer_stmin);
+    RUN_TEST(test_flow_control_during_write);
+    RUN_TEST(test_refused_first_frame);
+    RUN_TEST(test_refused_block_end);
+    RUN_TEST(test_wait_then_clear_to_send);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_no_flow_control);
+    RUN_TEST(test_two_buffers);
+    return UNITY_END();
+}
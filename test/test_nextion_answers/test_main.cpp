@@ -0,0 +1,229 @@
+#include <unity.h>
+
+#include <nextion_link.h>
+
+#include <string>
+
+#include "../../src/nextion.cpp"
+#include "../../src/trace.cpp"
+#include "../../tools/nextion_emulator/nextion_emulator.cpp"
+
+/*
+What comes back from the display: NextionParser's framing, answers matched to the commands
+they belong to, resync() on sendme, the 0x24 pause and throttle, and the touch and page
+callbacks. The emulator is declared like the display project, with rpm a Number so rpm.txt=
+fails with 0x1A the way a wrong binding would. Which command an error was counted against is
+read back from the DISPLAY_FAILED trace line, Serial goes to a port that keeps what Trace
+writes.
+*/
+
+class traceCapture : public hostPort {
+public:
+    std::string out;
+
+    size_t write(const uint8_t *buf, size_t n) override {
+        out.append((const char *)buf, n);
+        return n;
+    }
+    int availableForWrite() override { return 4096; }
+};
+
+static nextionLink link(115200);
+static traceCapture trace;
+
+static uint8_t touchedPage, touchedComponent;
+static bool touchedPressed;
+static uint32_t touches;
+static int lastPage = -1;
+
+static void onTouch(uint8_t page, uint8_t component, bool pressed) {
+    touchedPage = page;
+    touchedComponent = component;
+    touchedPressed = pressed;
+    touches++;
+}
+
+static void onPage(uint8_t page) { lastPage = page; }
+
+static void settle(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        hostMicros += 1000;
+        NextionInterface::task();
+        Trace::task();
+    }
+    link.display.advance(hostMicros);
+}
+
+static void setAll(int offset) {
+    NextionInterface::setWaterTemp(80 + offset);
+    NextionInterface::setOilTemp(90 + offset);
+    NextionInterface::setOilPressure(27 + offset, 0); // 100 PSI and up
+    NextionInterface::setVoltage(12.5f + offset * 0.1f);
+    NextionInterface::setLambda(1.0f + offset * 0.01f);
+    NextionInterface::setGear(1 + offset % 5);
+}
+
+// every field but the rpm, which fails on purpose
+static const char *const FIELDS[] = { "driver.watertempvalue", "driver.oiltempvalue", "driver.oilpressvalue",
+    "driver.voltvalue", "driver.gear", "driver.lambdabool" };
+
+static void countUpdates(uint64_t *updates) {
+    for (size_t i = 0; i < sizeof(FIELDS) / sizeof(FIELDS[0]); i++) {
+        updates[i] = link.display.getComponentStats().at(FIELDS[i]).updates;
+    }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+// a message is framed by its code's length where the data can hold 0xFF
+void test_parser_framing() {
+    static uint8_t messages[4][8];
+    static uint8_t lengths[4];
+    static uint8_t count;
+    count = 0;
+    NextionParser parser([](const uint8_t *message, uint8_t length) {
+        if (count < 4) {
+            memcpy(messages[count], message, length);
+            lengths[count++] = length;
+        }
+    });
+    static const uint8_t stream[] = {
+        0x65, 0x02, 0xFF, 0x01, 0xFF, 0xFF, 0xFF, // touch on component 0xFF
+        0x1A, 0xFF, 0xFF, 0xFF,
+        0x71, 0xFF, 0xFF, 0xFF, 0x00, 0xFF, 0xFF, 0xFF, // get answered with 0x00FFFFFF
+        0x66, 0x02, 0xFF, 0xFF, 0xFF,
+    };
+    for (uint8_t b : stream) {
+        parser.feed(b);
+    }
+    TEST_ASSERT_EQUAL(4, count);
+    TEST_ASSERT_EQUAL(4, lengths[0]);
+    TEST_ASSERT_EQUAL_MEMORY("\x65\x02\xFF\x01", messages[0], 4);
+    TEST_ASSERT_EQUAL(1, lengths[1]);
+    TEST_ASSERT_EQUAL_HEX8(0x1A, messages[1][0]);
+    TEST_ASSERT_EQUAL(5, lengths[2]);
+    TEST_ASSERT_EQUAL_MEMORY("\x71\xFF\xFF\xFF\x00", messages[2], 5);
+    TEST_ASSERT_EQUAL(2, lengths[3]);
+    TEST_ASSERT_EQUAL_MEMORY("\x66\x02", messages[3], 2);
+    TEST_ASSERT_EQUAL(0, parser.discarded());
+}
+
+void test_touch_and_page() {
+    Serial2.port = &link;
+    Serial.port = &trace;
+    link.display.addPage(0, "loading");
+    link.display.addPage(1, "startup");
+    link.display.addPage(2, "driver");
+    link.display.addPage(3, "yippee");
+    link.display.addPage(4, "warning");
+    link.display.addComponent("driver", 1, "watertempvalue", "Text");
+    link.display.addComponent("driver", 2, "oiltempvalue", "Text");
+    link.display.addComponent("driver", 3, "oilpressvalue", "Text");
+    link.display.addComponent("driver", 4, "voltvalue", "Text");
+    link.display.addComponent("driver", 5, "MessageDriver", "Text");
+    link.display.addComponent("driver", 6, "rpm", "Number");
+    link.display.addComponent("driver", 7, "gear", "Text");
+    link.display.addComponent("driver", 8, "lambdabool", "Text");
+    NextionInterface::onTouch(onTouch);
+    NextionInterface::onPage(onPage);
+
+    NextionInterface::init();
+    NextionInterface::switchToDriver();
+    setAll(0);
+    settle(1500);
+    TEST_ASSERT_EQUAL(2, lastPage); // the once a second sendme
+    TEST_ASSERT_EQUAL(0, NextionInterface::getLinkStats().failed);
+
+    link.display.touch(hostMicros, 0xFF, true);
+    settle(10);
+    link.display.touch(hostMicros, 7, false);
+    settle(10);
+    TEST_ASSERT_EQUAL(2, touches);
+    TEST_ASSERT_EQUAL(2, touchedPage);
+    TEST_ASSERT_EQUAL(7, touchedComponent);
+    TEST_ASSERT_FALSE(touchedPressed);
+}
+
+// rpm.txt= on a Number is counted against the rpm field, and nothing else is
+void test_error_lands_on_its_command() {
+    uint32_t failed = NextionInterface::getLinkStats().failed;
+    trace.out.clear();
+    setAll(1);
+    NextionInterface::setRPM(4000);
+    settle(500);
+    TEST_ASSERT_EQUAL(failed + 1, NextionInterface::getLinkStats().failed);
+    TEST_ASSERT_TRUE_MESSAGE(trace.out.find("display command 5 failed with 0x1A") != std::string::npos, trace.out.c_str());
+    TEST_ASSERT_EQUAL(std::string::npos, trace.out.find("failed with", trace.out.find("failed with") + 1));
+}
+
+// a command the display never got leaves the answers after it one command off, until the next
+// sendme's answer gives it up and the error after it is counted against rpm again
+void test_lost_command_realigned_by_sendme() {
+    settle(2000);
+    uint32_t unanswered = NextionInterface::getLinkStats().unanswered;
+    NextionInterface::setWaterTemp(82); // one command, the band stays the same
+    link.lose = 1;
+    settle(60);
+    TEST_ASSERT_EQUAL(0, link.lose);
+    TEST_ASSERT_EQUAL(unanswered, NextionInterface::getLinkStats().unanswered);
+    settle(1000);
+    TEST_ASSERT_EQUAL(unanswered + 1, NextionInterface::getLinkStats().unanswered);
+
+    trace.out.clear();
+    NextionInterface::setRPM(5000);
+    settle(200);
+    TEST_ASSERT_TRUE_MESSAGE(trace.out.find("display command 5 failed with 0x1A") != std::string::npos, trace.out.c_str());
+}
+
+// the display's input buffer overflows: output pauses, the budget halves, and every field is
+// sent again once it goes on
+void test_overflow_pauses_and_resends() {
+    settle(1000);
+    link.display.inputBufferSize = 40;
+    link.display.processingUs = 20000;
+    uint64_t before[6], after[6];
+    countUpdates(before);
+    setAll(2);
+    uint32_t start = hostMicros;
+    while (NextionInterface::getLinkStats().overflows == 0 && hostMicros - start < 2000000) {
+        settle(1);
+    }
+    TEST_ASSERT_EQUAL(1, NextionInterface::getLinkStats().overflows);
+    TEST_ASSERT_EQUAL(0, link.blocked);
+
+    // nothing but the sendme goes out while paused
+    link.display.inputBufferSize = 1024;
+    link.display.processingUs = 0;
+    settle(10);
+    uint64_t written = link.written;
+    countUpdates(after);
+    settle(200);
+    TEST_ASSERT_LESS_OR_EQUAL(written + 9, link.written); // sendme\xFF\xFF\xFF
+
+    // what was sent before the overflow counts once, the resend once more
+    settle(1000);
+    uint64_t resent[6];
+    countUpdates(resent);
+    for (size_t i = 0; i < 6; i++) {
+        TEST_ASSERT_GREATER_THAN_MESSAGE(after[i], resent[i], FIELDS[i]);
+        TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(before[i] + 1, resent[i], FIELDS[i]);
+    }
+    TEST_ASSERT_EQUAL_STRING("179 \xB0" "F", link.display.text("driver", "watertempvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("107 PSI", link.display.text("driver", "oilpressvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("12.7 V", link.display.text("driver", "voltvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("3", link.display.text("driver", "gear").c_str());
+    TEST_ASSERT_EQUAL_STRING("1.020 LA", link.display.text("driver", "lambdabool").c_str());
+    TEST_ASSERT_EQUAL(1, NextionInterface::getLinkStats().overflows);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_parser_framing);
+    RUN_TEST(test_touch_and_page);
+    RUN_TEST(test_error_lands_on_its_command);
+    RUN_TEST(test_lost_command_realigned_by_sendme);
+    RUN_TEST(test_overflow_pauses_and_resends);
+    return UNITY_END();
+}
@@ -0,0 +1,201 @@
+#include <unity.h>
+
+#include <new>
+#include <string>
+
+#include "../../src/nextion.cpp"
+#include "../../src/trace.cpp"
+
+/*
+NextionCommand against what the Arduino String code it replaced put on the wire, and the
+display path as a whole against the heap. The String reference is snprintf: String(int) is
+%d, String(float, n) is dtostrf, which is %.nf of the float widened to double.
+
+Every operator new in this program is counted, the driver part checks init() and ten seconds
+of updates make none.
+*/
+
+static size_t allocations = 0;
+
+void *operator new(size_t n) {
+    allocations++;
+    return malloc(n ? n : 1);
+}
+void *operator new[](size_t n) {
+    allocations++;
+    return malloc(n ? n : 1);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static uint8_t buffer[64];
+
+static void expect(const NextionCommand &command, const char *reference) {
+    TEST_ASSERT_TRUE_MESSAGE(command.ok(), reference);
+    TEST_ASSERT_EQUAL_MESSAGE(strlen(reference), command.size(), reference);
+    TEST_ASSERT_EQUAL_MEMORY(reference, buffer, command.size());
+}
+
+// a display that only answers sendme, and keeps everything it was sent
+class capturePort : public hostPort {
+public:
+    uint8_t sent[65536];
+    size_t sentLength = 0;
+    uint32_t writes = 0;
+
+    size_t write(const uint8_t *buf, size_t n) override {
+        for (size_t i = 0; i < n; i++) {
+            if (sentLength < sizeof(sent)) {
+                sent[sentLength++] = buf[i];
+            }
+            if (sentLength >= 9 && memcmp(sent + sentLength - 9, "sendme\xFF\xFF\xFF", 9) == 0) {
+                memcpy(answer, "\x66\x00\xFF\xFF\xFF", 5);
+                answerLength = 5;
+                answerPos = 0;
+            }
+        }
+        writes++;
+        return n;
+    }
+
+    int available() override {
+        hostMicros++;
+        return answerLength - answerPos;
+    }
+
+    int read() override { return answerPos < answerLength ? answer[answerPos++] : -1; }
+
+    // the last command the display got that starts with prefix
+    std::string last(const char *prefix) const {
+        std::string found;
+        size_t start = 0;
+        for (size_t i = 0; i + 2 < sentLength; i++) {
+            if (sent[i] == 0xFF && sent[i + 1] == 0xFF && sent[i + 2] == 0xFF) {
+                std::string command((const char *)sent + start, i - start);
+                if (command.compare(0, strlen(prefix), prefix) == 0) {
+                    found = command;
+                }
+                i += 2;
+                start = i + 1;
+            }
+        }
+        return found;
+    }
+
+private:
+    uint8_t answer[5];
+    uint8_t answerLength = 0;
+    uint8_t answerPos = 0;
+};
+
+static capturePort port;
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_integers() {
+    char reference[64];
+    for (int celsius = -40; celsius <= 215; celsius++) {
+        int f = (celsius * 9 / 5) + 32;
+        NextionCommand c(buffer, sizeof(buffer));
+        c.text("watertempvalue.txt=\"").integer(f).text(" \xB0" "F\"");
+        snprintf(reference, sizeof(reference), "watertempvalue.txt=\"%d \xB0" "F\"", f);
+        expect(c, reference);
+    }
+    for (uint32_t rpm = 0; rpm < 20000; rpm += 7) {
+        NextionCommand c(buffer, sizeof(buffer));
+        c.text("rpm.txt=\"").integer(rpm / 100 * 100).character('"');
+        snprintf(reference, sizeof(reference), "rpm.txt=\"%u\"", rpm / 100 * 100);
+        expect(c, reference);
+    }
+    NextionCommand c(buffer, sizeof(buffer));
+    c.integer(INT32_MIN);
+    expect(c, "-2147483648");
+}
+
+void test_decimals() {
+    char reference[64];
+    for (int v = 0; v <= 255; v++) {
+        float volts = v * 0.1;
+        NextionCommand c(buffer, sizeof(buffer));
+        c.text("voltvalue.txt=\"").decimal(volts, 1).text(" V\"");
+        snprintf(reference, sizeof(reference), "voltvalue.txt=\"%.1f V\"", volts);
+        expect(c, reference);
+    }
+    for (int v = 0; v <= 2000; v++) {
+        float lambda = v * 0.00077f;
+        NextionCommand c(buffer, sizeof(buffer));
+        c.text("lambdabool.txt=\"").decimal(lambda, 3).text(" LA\"");
+        snprintf(reference, sizeof(reference), "lambdabool.txt=\"%.3f LA\"", lambda);
+        expect(c, reference);
+    }
+    NextionCommand c(buffer, sizeof(buffer));
+    c.fixed(-5, 2);
+    expect(c, "-0.05");
+}
+
+void test_overflow() {
+    NextionCommand c(buffer, 10);
+    c.text("watertempvalue.txt=\"");
+    TEST_ASSERT_FALSE(c.ok());
+    NextionCommand d(buffer, 3);
+    d.integer(1234);
+    TEST_ASSERT_FALSE(d.ok());
+}
+
+void test_formatting_does_not_allocate() {
+    size_t before = allocations;
+    for (int i = 0; i < 1000; i++) {
+        NextionCommand c(buffer, sizeof(buffer));
+        c.text("lambdabool.txt=\"").decimal(i * 0.001f, 3).text(" LA\"").integer(i);
+    }
+    TEST_ASSERT_EQUAL(before, allocations);
+}
+
+void test_driver_does_not_allocate() {
+    Serial2.port = &port;
+    size_t before = allocations;
+
+    NextionInterface::init();
+    NextionInterface::switchToDriver();
+    uint32_t start = hostMicros;
+    for (uint32_t ms = 0; ms < 10000; ms++) {
+        hostMicros = start + ms * 1000;
+        NextionInterface::setWaterTemp(80 + ms / 500 % 20);
+        NextionInterface::setOilTemp(90 + ms / 300 % 30);
+        NextionInterface::setOilPressure(0, ms / 10 % 100);
+        NextionInterface::setVoltage(12 + (ms % 17) * 0.1f);
+        NextionInterface::setRPM(3000 + ms % 1000 * 5);
+        NextionInterface::setLambda(0.9f + (ms % 13) * 0.01f);
+        NextionInterface::setGear(1 + ms / 777 % 5);
+        NextionInterface::task();
+    }
+    // long enough for the voltage's 500ms minInterval
+    for (int i = 0; i < 1000; i++) {
+        hostMicros += 1000;
+        NextionInterface::task();
+    }
+    TEST_ASSERT_EQUAL(before, allocations);
+
+    // the display ends up with the last values, batched several to a write
+    TEST_ASSERT_EQUAL_STRING("watertempvalue.txt=\"210 \xB0" "F\"", port.last("watertempvalue.txt").c_str());
+    TEST_ASSERT_EQUAL_STRING("voltvalue.txt=\"12.3 V\"", port.last("voltvalue.txt").c_str());
+    TEST_ASSERT_EQUAL_STRING("rpm.txt=\"7900\"", port.last("rpm.txt").c_str());
+    TEST_ASSERT_EQUAL_STRING("gear.txt=\"3\"", port.last("gear.txt").c_str());
+    const NextionInterface::linkStats &link = NextionInterface::getLinkStats();
+    TEST_ASSERT_EQUAL(0, link.dropped);
+    TEST_ASSERT_GREATER_THAN(port.writes, link.messages);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_integers);
+    RUN_TEST(test_decimals);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_formatting_does_not_allocate);
+    RUN_TEST(test_driver_does_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+
+#include "../../tools/nextion_emulator/nextion_emulator.cpp"
+
+/*
+tools/nextion_emulator on its own, fed a capture of the Serial2 TX line the way
+nextion_replay.cpp plays one: the whole stream written at once at 9600 baud, then advanced
+until everything has run. The capture is the start of a session, bkcmd=3, the driver page and
+a few widgets, with a command the display doesn't know and a baud= part way through.
+*/
+
+static const uint8_t capture[] = {
+    'b', 'k', 'c', 'm', 'd', '=', '3', 0xFF, 0xFF, 0xFF,
+    'p', 'a', 'g', 'e', ' ', 'd', 'r', 'i', 'v', 'e', 'r', 0xFF, 0xFF, 0xFF,
+    'w', 'a', 't', 'e', 'r', 't', 'e', 'm', 'p', 'v', 'a', 'l', 'u', 'e', '.', 't', 'x', 't', '=', '"', '1', '8', '0', ' ',
+        0xB0, 'F', '"', 0xFF, 0xFF, 0xFF,
+    'r', 'p', 'm', '.', 't', 'x', 't', '=', '"', '4', '5', '0', '0', '"', 0xFF, 0xFF, 0xFF,
+    'r', 'p', 'm', '.', 'p', 'c', 'o', '=', '4', '5', '0', '5', '6', 0xFF, 0xFF, 0xFF,
+    'b', 'o', 'g', 'u', 's', 0xFF, 0xFF, 0xFF,
+    'b', 'a', 'u', 'd', '=', '1', '1', '5', '2', '0', '0', 0xFF, 0xFF, 0xFF,
+    'g', 'e', 'a', 'r', '.', 't', 'x', 't', '=', '"', '3', '"', 0xFF, 0xFF, 0xFF,
+};
+
+// what replaying takes at the slowest rate, as nextion_replay.cpp waits
+static const uint64_t END_US = sizeof(capture) * 10000000ull / 2400 + 1000000;
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_replay() {
+    NextionEmulator display(9600);
+    display.write(0, capture, sizeof(capture));
+    display.advance(END_US);
+
+    TEST_ASSERT_EQUAL_STRING("driver", display.currentPage().c_str());
+    TEST_ASSERT_EQUAL_STRING("180 \xB0" "F", display.text("driver", "watertempvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("4500", display.text("driver", "rpm").c_str());
+    TEST_ASSERT_EQUAL_STRING("3", display.text("driver", "gear").c_str());
+    NextionEmulator::value colour;
+    TEST_ASSERT_TRUE(display.get("driver", "rpm", "pco", colour));
+    TEST_ASSERT_FALSE(colour.isText);
+    TEST_ASSERT_EQUAL(45056, colour.number);
+
+    const NextionEmulator::stats &stats = display.getStats();
+    TEST_ASSERT_EQUAL(sizeof(capture), stats.bytes);
+    TEST_ASSERT_EQUAL(8, stats.commands);
+    TEST_ASSERT_EQUAL(1, stats.failed);
+    TEST_ASSERT_EQUAL(0, stats.overflows);
+    TEST_ASSERT_EQUAL(1, stats.pageChanges);
+    TEST_ASSERT_EQUAL(2, display.getComponentStats().at("driver.rpm").updates);
+    TEST_ASSERT_EQUAL(115200, display.baud());
+}
+
+// with bkcmd=3 every command is answered, the unknown one with 0x00
+void test_return_codes() {
+    NextionEmulator display(9600);
+    display.write(0, capture, sizeof(capture));
+    uint8_t answers[64];
+    size_t n = display.read(END_US, answers, sizeof(answers));
+
+    static const uint8_t codes[] = { 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x01, 0x01 };
+    TEST_ASSERT_EQUAL(sizeof(codes) * 4, n);
+    for (size_t i = 0; i < sizeof(codes); i++) {
+        TEST_ASSERT_EQUAL_HEX8(codes[i], answers[i * 4]);
+        TEST_ASSERT_EQUAL_MEMORY("\xFF\xFF\xFF", answers + i * 4 + 1, 3);
+    }
+}
+
+// a display too slow for the stream drops what its input buffer can't take, answers 0x24,
+// and throws the command it lost bytes from away
+void test_overflow() {
+    NextionEmulator display(9600);
+    display.processingUs = 100000;
+    display.inputBufferSize = 32;
+    display.write(0, capture, sizeof(capture));
+    display.advance(END_US + 10 * display.processingUs);
+
+    const NextionEmulator::stats &stats = display.getStats();
+    TEST_ASSERT_GREATER_THAN(0, stats.overflows);
+    TEST_ASSERT_LESS_THAN(8, stats.commands);
+    TEST_ASSERT_EQUAL_STRING("driver", display.currentPage().c_str());
+
+    uint8_t answers[64];
+    size_t n = display.read(END_US + 10 * display.processingUs, answers, sizeof(answers));
+    bool overflowAnswered = false;
+    for (size_t i = 0; i + 3 < n; i += 4) {
+        overflowAnswered |= answers[i] == 0x24;
+    }
+    TEST_ASSERT_TRUE(overflowAnswered);
+}
+
+// a declared component takes the attributes its type has in nextion_tft.h, a Dual-state button
+// both a caption and a state
+void test_declared_types() {
+    NextionEmulator display(9600);
+    display.addPage(0, "driver");
+    display.addComponent("driver", 1, "toggle", "Dual-state button");
+    display.addComponent("driver", 2, "count", "Number");
+    display.addComponent("driver", 3, "label", "Text");
+    static const char commands[] = "bkcmd=3\xFF\xFF\xFF"
+        "toggle.txt=\"ON\"\xFF\xFF\xFF" "toggle.val=1\xFF\xFF\xFF"
+        "count.val=42\xFF\xFF\xFF" "count.txt=\"42\"\xFF\xFF\xFF"
+        "label.txt=\"hi\"\xFF\xFF\xFF" "label.val=1\xFF\xFF\xFF";
+    display.write(0, (const uint8_t *)commands, sizeof(commands) - 1);
+    uint8_t answers[64];
+    size_t n = display.read(END_US, answers, sizeof(answers));
+
+    static const uint8_t codes[] = { 0x01, 0x01, 0x01, 0x01, 0x1A, 0x01, 0x1A };
+    TEST_ASSERT_EQUAL(sizeof(codes) * 4, n);
+    for (size_t i = 0; i < sizeof(codes); i++) {
+        TEST_ASSERT_EQUAL_HEX8(codes[i], answers[i * 4]);
+    }
+    TEST_ASSERT_EQUAL_STRING("ON", display.text("driver", "toggle").c_str());
+    NextionEmulator::value state;
+    TEST_ASSERT_TRUE(display.get("driver", "toggle", "val", state));
+    TEST_ASSERT_EQUAL(1, state.number);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_replay);
+    RUN_TEST(test_return_codes);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_declared_types);
+    return UNITY_END();
+}
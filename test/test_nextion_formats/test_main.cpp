@@ -0,0 +1,109 @@
+#include <unity.h>
+
+#include <nextion_link.h>
+
+#include <nextion_widgets.h>
+
+/*
+The .val formats against the emulator. Nothing in nextion_widgets.h uses them yet, so this
+table moves the water temperature to VALUE_FAHRENHEIT and the oil pressure to VALUE, as a row
+would once its component is a Number in the display project, and keeps the rest. The build
+checks the bindings against nextion_tft.h, here the emulator's component types do, by the
+same type table.
+*/
+
+#undef NEXTION_WIDGETS
+#define NEXTION_WIDGETS(X) \
+    X(WATER_TEMP,     "watertempvalue",  DRIVER, VALUE_FAHRENHEIT, 0, 1,   "",          1,     BANDS(NO_LIMIT_LOW, NO_LIMIT_LOW, 100, 108, 2), 4, 250, 1000) \
+    X(OIL_TEMP,       "oiltempvalue",    DRIVER, FAHRENHEIT,       0, 1,   " \xB0" "F", 1,     NO_BANDS,                                       4, 250, 1000) \
+    X(OIL_PRESSURE,   "oilpressvalue",   DRIVER, VALUE,            0, 1,   "",          1,     BANDS(10, 20, NO_LIMIT_HIGH, NO_LIMIT_HIGH, 2), 5, 100, 500)  \
+    X(VOLTAGE,        "voltvalue",       DRIVER, NUMBER,           1, 1,   " V",        -10,   NO_BANDS,                                       2, 500, 2000) \
+    X(DRIVER_MESSAGE, "MessageDriver",   DRIVER, NUMBER,           0, 1,   "",          0,     NO_BANDS,                                       6, 0,   200)  \
+    X(RPM,            "rpm",             DRIVER, NUMBER,           0, 100, "",          1,     NO_BANDS,                                       5, 100, 250)  \
+    X(GEAR,           "gear",            DRIVER, CHARACTER,        0, 1,   "",          '?',   NO_BANDS,                                       7, 0,   50)   \
+    X(LAMBDA,         "lambdabool",      DRIVER, NUMBER,           3, 1,   " LA",       -1000, NO_BANDS,                                       3, 200, 1000)
+
+#define NextionTft NextionProjectTft
+#include <nextion_tft.h>
+#undef NextionTft
+
+class NextionTft : public NextionProjectTft {
+public:
+    constexpr static bool hasAttribute(const char *, const char *, const char *) { return true; }
+};
+
+#include "../../src/nextion.cpp"
+#include "../../src/trace.cpp"
+#include "../../tools/nextion_emulator/nextion_emulator.cpp"
+
+static nextionLink link(115200);
+
+static void settle(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        hostMicros += 1000;
+        NextionInterface::task();
+    }
+    link.display.advance(hostMicros);
+}
+
+static int32_t number(const char *component) {
+    NextionEmulator::value v;
+    TEST_ASSERT_TRUE_MESSAGE(link.display.get("driver", component, "val", v), component);
+    TEST_ASSERT_FALSE_MESSAGE(v.isText, component);
+    return v.number;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_value_formats() {
+    Serial2.port = &link;
+    link.display.addPage(0, "loading");
+    link.display.addPage(1, "startup");
+    link.display.addPage(2, "driver");
+    link.display.addPage(3, "yippee");
+    link.display.addPage(4, "warning");
+    link.display.addComponent("driver", 1, "watertempvalue", "Number");
+    link.display.addComponent("driver", 2, "oiltempvalue", "Text");
+    link.display.addComponent("driver", 3, "oilpressvalue", "Number");
+    link.display.addComponent("driver", 4, "voltvalue", "Text");
+    link.display.addComponent("driver", 5, "MessageDriver", "Text");
+    link.display.addComponent("driver", 6, "rpm", "Text");
+    link.display.addComponent("driver", 7, "gear", "Text");
+    link.display.addComponent("driver", 8, "lambdabool", "Text");
+    NextionInterface::init();
+    link.display.resetStats();
+    NextionInterface::switchToDriver();
+
+    NextionInterface::setWaterTemp(90);
+    NextionInterface::setOilTemp(90);
+    NextionInterface::setOilPressure(27, 0); // 100 PSI
+    settle(500);
+    TEST_ASSERT_EQUAL(194, number("watertempvalue"));
+    TEST_ASSERT_EQUAL_STRING("194 \xB0" "F", link.display.text("driver", "oiltempvalue").c_str());
+    TEST_ASSERT_EQUAL(100, number("oilpressvalue"));
+
+    NextionInterface::setWaterTemp(-40);
+    NextionInterface::setOilPressure(0, 0);
+    settle(500);
+    TEST_ASSERT_EQUAL(-40, number("watertempvalue"));
+    TEST_ASSERT_EQUAL(0, number("oilpressvalue"));
+
+    // the bands still colour a .val widget
+    NextionInterface::setWaterTemp(110);
+    settle(500);
+    TEST_ASSERT_EQUAL(230, number("watertempvalue"));
+    NextionEmulator::value colour;
+    TEST_ASSERT_TRUE(link.display.get("driver", "watertempvalue", "pco", colour));
+    TEST_ASSERT_EQUAL(45056, colour.number); // red
+
+    // a Number rejects .txt=, so nothing here went out as text
+    TEST_ASSERT_EQUAL(0, link.display.getStats().failed);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_value_formats);
+    return UNITY_END();
+}
@@ -0,0 +1,73 @@
+#include <unity.h>
+
+#include <nextion_link.h>
+
+#include "../../src/nextion.cpp"
+#include "../../src/trace.cpp"
+#include "../../tools/nextion_emulator/nextion_emulator.cpp"
+
+/*
+Page changes against the emulator. A page comes up as drawn in the editor, and only the fields
+that have had a value are sent again over it: one nothing has set yet (oil pressure and lambda
+have no CAN source at the moment) must not show its initial value as if it were a reading.
+*/
+
+static const char *const DRIVER_COMPONENTS[] = { "watertempvalue", "oiltempvalue", "oilpressvalue", "voltvalue",
+    "MessageDriver", "rpm", "gear", "lambdabool" };
+
+static nextionLink link(115200);
+
+static void settle(uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        hostMicros += 1000;
+        NextionInterface::task();
+    }
+    link.display.advance(hostMicros);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_page_before_any_data() {
+    Serial2.port = &link;
+    NextionInterface::init();
+    // the probes' bare terminators are answered as invalid, the page test starts from here
+    link.display.resetStats();
+    NextionInterface::switchToDriver();
+    settle(500);
+
+    TEST_ASSERT_EQUAL_STRING("driver", link.display.currentPage().c_str());
+    for (const char *component : DRIVER_COMPONENTS) {
+        NextionEmulator::value v;
+        TEST_ASSERT_FALSE_MESSAGE(link.display.get("driver", component, "txt", v), component);
+    }
+    TEST_ASSERT_EQUAL(0, link.display.getStats().failed);
+}
+
+void test_only_set_fields_are_resent() {
+    NextionInterface::setWaterTemp(90);
+    NextionInterface::setDriverMessage(0); // the initial value, still a first value
+    settle(500);
+    TEST_ASSERT_EQUAL_STRING("194 \xB0" "F", link.display.text("driver", "watertempvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", link.display.text("driver", "MessageDriver").c_str());
+
+    NextionInterface::switchToWarning();
+    settle(100);
+    NextionInterface::switchToDriver();
+    settle(500);
+    TEST_ASSERT_EQUAL_STRING("194 \xB0" "F", link.display.text("driver", "watertempvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("0", link.display.text("driver", "MessageDriver").c_str());
+    NextionEmulator::value v;
+    TEST_ASSERT_FALSE(link.display.get("driver", "oilpressvalue", "txt", v));
+    TEST_ASSERT_FALSE(link.display.get("driver", "lambdabool", "txt", v));
+    TEST_ASSERT_FALSE(link.display.get("driver", "rpm", "txt", v));
+    TEST_ASSERT_EQUAL(0, link.display.getStats().failed);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_page_before_any_data);
+    RUN_TEST(test_only_set_fields_are_resent);
+    return UNITY_END();
+}
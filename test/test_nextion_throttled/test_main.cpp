@@ -0,0 +1,145 @@
+#include <unity.h>
+
+#include <nextion_link.h>
+
+#include "../../src/nextion.cpp"
+#include "../../src/trace.cpp"
+#include "../../tools/nextion_emulator/nextion_emulator.cpp"
+
+/*
+The display path against a UART that really is as slow as its baud. The display won't go past
+the rate under test, so init() settles there, then every field changes every millisecond for
+ten seconds. Nothing may be written past availableForWrite(), that's where the Teensy would
+wait, and what reaches the display has to keep up: the gear within a bound, the rest merged to
+their latest value instead of queued.
+*/
+
+static const uint32_t RUN_MS = 10000;
+
+static void setAll(uint32_t ms) {
+    NextionInterface::setWaterTemp(80 + ms / 500 % 20);
+    NextionInterface::setOilTemp(90 + ms / 300 % 30);
+    NextionInterface::setOilPressure(0, ms / 10 % 100);
+    NextionInterface::setVoltage(12 + (ms % 17) * 0.1f);
+    NextionInterface::setRPM(3000 + ms % 1000 * 5);
+    NextionInterface::setLambda(0.9f + (ms % 13) * 0.01f);
+}
+
+static void settle(nextionLink &link, uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        hostMicros += 1000;
+        NextionInterface::task();
+    }
+    link.display.advance(hostMicros);
+}
+
+// the display shows what the driver was last told
+static void expectLatest(nextionLink &link) {
+    TEST_ASSERT_EQUAL_STRING("210 \xB0" "F", link.display.text("driver", "watertempvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("12.3 V", link.display.text("driver", "voltvalue").c_str());
+    TEST_ASSERT_EQUAL_STRING("7900", link.display.text("driver", "rpm").c_str());
+    TEST_ASSERT_EQUAL_STRING("3", link.display.text("driver", "gear").c_str());
+}
+
+static void run(uint32_t baud) {
+    nextionLink link;
+    link.display.maxBaud = baud;
+    Serial2.port = &link;
+
+    NextionInterface::init();
+    NextionInterface::switchToDriver();
+    const NextionInterface::linkStats stats = NextionInterface::getLinkStats();
+    TEST_ASSERT_EQUAL(baud, stats.baud);
+    TEST_ASSERT_EQUAL(baud, link.display.baud());
+    link.display.resetStats();
+
+    uint32_t start = hostMicros, rpmUpdates = 0, gearChangedAt = 0, worstGear = 0;
+    char gear = 0;
+    uint64_t wireBefore = link.written;
+    for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+        hostMicros = start + ms * 1000;
+        setAll(ms);
+        rpmUpdates++;
+        char shifted = '1' + ms / 777 % 5;
+        if (shifted != gear) {
+            gear = shifted;
+            gearChangedAt = ms;
+            NextionInterface::setGear(gear - '0');
+        }
+        NextionInterface::task();
+        link.display.advance(hostMicros);
+        if (gearChangedAt && link.display.text("driver", "gear") == std::string(1, gear)) {
+            worstGear = max(worstGear, ms - gearChangedAt);
+            gearChangedAt = 0;
+        }
+    }
+    settle(link, 1000);
+    TEST_ASSERT_EQUAL(gearChangedAt, 0);
+
+    char line[128];
+    snprintf(line, sizeof(line), "%u baud: %llu bytes in %u ms, %llu rpm commands for %u updates, worst gear %u ms", baud,
+        (unsigned long long)(link.written - wireBefore), RUN_MS + 1000,
+        (unsigned long long)link.display.getComponentStats().at("driver.rpm").updates, rpmUpdates, worstGear);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL(0, link.blocked);
+    // no more than the link moves, and the fields merged to fit in it
+    TEST_ASSERT_LESS_OR_EQUAL((uint64_t)baud / 10 * (RUN_MS + 1000) / 1000 + nextionLink::TX_FIFO, link.written - wireBefore);
+    TEST_ASSERT_LESS_THAN(rpmUpdates, link.display.getComponentStats().at("driver.rpm").updates);
+    TEST_ASSERT_EQUAL(stats.dropped, NextionInterface::getLinkStats().dropped);
+    TEST_ASSERT_EQUAL(0, link.display.getStats().failed);
+    TEST_ASSERT_EQUAL(0, link.display.getStats().overflows);
+    // the gear goes ahead of everything else: the next 50ms render, then the UART's 64 bytes
+    // and its own command on the wire
+    TEST_ASSERT_LESS_OR_EQUAL(50 + (nextionLink::TX_FIFO + 20) * 10000 / baud + 1, worstGear);
+    expectLatest(link);
+    Serial2.port = nullptr;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_9600() { run(9600); }
+
+void test_115200() { run(115200); }
+
+// a UART that takes nothing for a while: task() keeps returning, the widgets stop at what the
+// ring can hold, and the display catches up with the latest values once it moves again. Only
+// the once a second sendme can find the ring full
+void test_stalled_uart() {
+    nextionLink link;
+    link.display.maxBaud = 115200;
+    Serial2.port = &link;
+    NextionInterface::init();
+    NextionInterface::switchToDriver();
+    settle(link, 100);
+    uint32_t dropped = NextionInterface::getLinkStats().dropped;
+
+    link.stalled = true;
+    uint32_t start = hostMicros;
+    for (uint32_t ms = 0; ms < RUN_MS; ms++) {
+        hostMicros = start + ms * 1000;
+        setAll(ms);
+        NextionInterface::setGear(ms / 777 % 5 + 1);
+        NextionInterface::task();
+        // a poll or two per task, nothing that waits
+        TEST_ASSERT_LESS_THAN(start + ms * 1000 + 100, hostMicros);
+    }
+    TEST_ASSERT_EQUAL(0, link.blocked);
+    TEST_ASSERT_LESS_OR_EQUAL(dropped + RUN_MS / 1000, NextionInterface::getLinkStats().dropped);
+
+    link.stalled = false;
+    settle(link, 200);
+    TEST_ASSERT_EQUAL(0, link.blocked);
+    expectLatest(link);
+    Serial2.port = nullptr;
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_9600);
+    RUN_TEST(test_115200);
+    RUN_TEST(test_stalled_uart);
+    return UNITY_END();
+}
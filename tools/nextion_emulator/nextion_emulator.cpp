@@ -0,0 +1,351 @@
+#include "nextion_emulator.h"
+
+#include "nextion_tft.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+NextionEmulator::NextionEmulator(uint32_t baud) : rate(baud) {}
+
+void NextionEmulator::addPage(uint8_t id, const std::string &name) {
+    pagesDeclared = true;
+    pages.push_back({ id, name, false, {} });
+}
+
+void NextionEmulator::addComponent(const std::string &pageName, uint8_t id, const std::string &name, const std::string &type) {
+    page *p = findPage(pageName);
+    if (!p) {
+        return;
+    }
+    p->declared = true;
+    p->components[name] = { id, type, {} };
+}
+
+void NextionEmulator::write(uint64_t atUs, const uint8_t *data, size_t length) {
+    uint64_t atNs = atUs * 1000;
+    for (size_t i = 0; i < length; i++) {
+        wireFreeNs = std::max(atNs, wireFreeNs) + byteNs();
+        wire.push_back({ wireFreeNs, atNs, data[i] });
+    }
+}
+
+void NextionEmulator::advance(uint64_t toUs) {
+    uint64_t toNs = toUs * 1000;
+    while (!wire.empty() && wire.front().arriveNs <= toNs) {
+        wireByte w = wire.front();
+        wire.pop_front();
+        // whatever ran before this byte arrived has made room for it
+        runUntil(w.arriveNs);
+        receive(w);
+    }
+    runUntil(toNs);
+}
+
+size_t NextionEmulator::read(uint64_t atUs, uint8_t *out, size_t max) {
+    advance(atUs);
+    size_t n = 0;
+    while (n < max && !answers.empty() && answers.front().first <= atUs * 1000) {
+        out[n++] = answers.front().second;
+        answers.pop_front();
+    }
+    return n;
+}
+
+void NextionEmulator::touch(uint64_t atUs, uint8_t component, bool pressed) {
+    answer(atUs * 1000, { 0x65, currentPageId(), component, (uint8_t)pressed, 0xFF, 0xFF, 0xFF });
+}
+
+const std::string &NextionEmulator::currentPage() const {
+    static const std::string none;
+    return pages.empty() ? none : pages[current].name;
+}
+
+uint8_t NextionEmulator::currentPageId() const {
+    return pages.empty() ? 0 : pages[current].id;
+}
+
+bool NextionEmulator::get(const std::string &pageName, const std::string &component, const std::string &attribute, value &out) const {
+    const page *p = findPage(pageName);
+    if (!p) {
+        return false;
+    }
+    auto c = p->components.find(component);
+    if (c == p->components.end()) {
+        return false;
+    }
+    auto a = c->second.attributes.find(attribute);
+    if (a == c->second.attributes.end()) {
+        return false;
+    }
+    out = a->second;
+    return true;
+}
+
+std::string NextionEmulator::text(const std::string &pageName, const std::string &component) const {
+    value v;
+    if (!get(pageName, component, "txt", v) || !v.isText) {
+        return "";
+    }
+    return v.text;
+}
+
+uint32_t NextionEmulator::baud() const {
+    return rate;
+}
+
+const NextionEmulator::stats &NextionEmulator::getStats() const {
+    return counters;
+}
+
+const std::map<std::string, NextionEmulator::componentStats> &NextionEmulator::getComponentStats() const {
+    return perComponent;
+}
+
+void NextionEmulator::resetStats() {
+    counters = {};
+    perComponent.clear();
+}
+
+uint64_t NextionEmulator::byteNs() const {
+    return 10000000000ull / rate;
+}
+
+void NextionEmulator::receive(const wireByte &w) {
+    counters.bytes++;
+    ffRun = w.b == 0xFF ? ffRun + 1 : 0;
+
+    if (buffered >= inputBufferSize) {
+        // the display only says so once, then drops until it has room again
+        counters.overflows++;
+        if (!corrupt) {
+            answer(w.arriveNs, { 0x24, 0xFF, 0xFF, 0xFF });
+            corrupt = true;
+        }
+    } else {
+        if (partial.empty()) {
+            partialWrittenNs = w.writtenNs;
+        }
+        partial.push_back(w.b);
+        buffered++;
+    }
+
+    if (ffRun < 3) {
+        return;
+    }
+    ffRun = 0;
+    if (corrupt || partial.size() < 3) {
+        buffered -= partial.size();
+        partial.clear();
+        corrupt = buffered >= inputBufferSize;
+        return;
+    }
+    partial.resize(partial.size() - 3);
+    // the buffer keeps the terminator until the command has run
+    busyUntilNs = std::max(w.arriveNs, busyUntilNs) + processingUs * 1000ull;
+    queue.push_back({ partial, partialWrittenNs, busyUntilNs });
+    partial.clear();
+}
+
+void NextionEmulator::runUntil(uint64_t toNs) {
+    while (!queue.empty() && queue.front().runNs <= toNs) {
+        pendingCommand command = queue.front();
+        queue.pop_front();
+        buffered -= command.bytes.size() + 3;
+        execute(command);
+    }
+}
+
+void NextionEmulator::execute(const pendingCommand &command) {
+    std::string s(command.bytes.begin(), command.bytes.end());
+    uint64_t at = command.runNs;
+
+    counters.commands++;
+    uint64_t latencyUs = (at - command.writtenNs) / 1000;
+    counters.totalLatencyUs += latencyUs;
+    counters.maxLatencyUs = std::max(counters.maxLatencyUs, latencyUs);
+
+    if (s == "sendme") {
+        answer(at, { 0x66, currentPageId(), 0xFF, 0xFF, 0xFF });
+        return;
+    }
+    if (s.compare(0, 5, "page ") == 0) {
+        result(at, changePage(s.substr(5)));
+        return;
+    }
+
+    size_t eq = s.find('=');
+    if (eq == std::string::npos || eq == 0) {
+        result(at, 0x00);
+        return;
+    }
+    std::string target = s.substr(0, eq);
+    std::string text = s.substr(eq + 1);
+    if (target.find('.') != std::string::npos) {
+        result(at, assign(target, text, command.bytes.size() + 3, at));
+        return;
+    }
+
+    // system variables
+    int32_t n;
+    if (!parseInteger(text, n)) {
+        result(at, 0x1B);
+        return;
+    }
+    if (target == "bkcmd") {
+        if (n < 0 || n > 3) {
+            result(at, 0x1B);
+            return;
+        }
+        bkcmd = n;
+        result(at, 0x01);
+        return;
+    }
+    if (target == "baud" || target == "bauds") {
+        static const int32_t rates[] = { 2400, 4800, 9600, 19200, 31250, 38400, 57600, 115200, 230400,
+            250000, 256000, 512000, 921600 };
+        if (std::find(std::begin(rates), std::end(rates), n) == std::end(rates) || (uint32_t)n > maxBaud) {
+            result(at, 0x11);
+            return;
+        }
+        // the answer still goes at the old rate, everything after at the new one
+        result(at, 0x01);
+        rate = n;
+        return;
+    }
+    static const char *const accepted[] = { "dim", "dims", "sleep", "thsp", "thup", "ussp", "usup", "wup", "sendxy" };
+    for (const char *name : accepted) {
+        if (target == name) {
+            result(at, 0x01);
+            return;
+        }
+    }
+    result(at, 0x1A);
+}
+
+uint8_t NextionEmulator::assign(const std::string &target, const std::string &text, size_t commandBytes, uint64_t atNs) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    for (size_t dot; (dot = target.find('.', start)) != std::string::npos; start = dot + 1) {
+        parts.push_back(target.substr(start, dot - start));
+    }
+    parts.push_back(target.substr(start));
+
+    page *p;
+    if (parts.size() == 2) {
+        p = &currentPageRef();
+    } else if (parts.size() == 3) {
+        p = findPage(parts[0]);
+        if (!p) {
+            return 0x1A;
+        }
+        parts.erase(parts.begin());
+    } else {
+        return 0x1A;
+    }
+    const std::string &name = parts[0];
+    const std::string &attribute = parts[1];
+
+    value v = {};
+    if (text.size() >= 2 && text.front() == '"' && text.back() == '"') {
+        v.isText = true;
+        v.text = text.substr(1, text.size() - 2);
+    } else if (!parseInteger(text, v.number)) {
+        return 0x1B;
+    }
+
+    auto c = p->components.find(name);
+    if (p->declared) {
+        if (c == p->components.end()) {
+            return 0x1A;
+        }
+        // the same table the firmware's bindings are checked against
+        bool typed = attribute == "txt" || attribute == "val";
+        if (typed && !NextionTft::typeHasAttribute(c->second.type.c_str(), attribute.c_str())) {
+            return 0x1A;
+        }
+        if (v.isText != (attribute == "txt")) {
+            return 0x1C;
+        }
+    } else if (c == p->components.end()) {
+        c = p->components.emplace(name, component{ 0xFF, "", {} }).first;
+    }
+    c->second.attributes[attribute] = v;
+
+    componentStats &cs = perComponent[p->name + "." + name];
+    cs.updates++;
+    cs.bytes += commandBytes;
+    cs.lastUpdateUs = atNs / 1000;
+    return 0x01;
+}
+
+// the display reloads the page even if it is already showing
+uint8_t NextionEmulator::changePage(const std::string &which) {
+    page *p = findPage(which);
+    if (!p) {
+        if (pagesDeclared) {
+            return 0x03;
+        }
+        pages.push_back({ (uint8_t)pages.size(), which, false, {} });
+        p = &pages.back();
+    }
+    current = p - pages.data();
+    for (auto &c : p->components) {
+        c.second.attributes.clear();
+    }
+    counters.pageChanges++;
+    return 0x01;
+}
+
+void NextionEmulator::answer(uint64_t atNs, const std::vector<uint8_t> &bytes) {
+    for (uint8_t b : bytes) {
+        answerFreeNs = std::max(atNs, answerFreeNs) + byteNs();
+        answers.push_back({ answerFreeNs, b });
+    }
+}
+
+void NextionEmulator::result(uint64_t atNs, uint8_t code) {
+    if (code != 0x01) {
+        counters.failed++;
+    }
+    bool send = code == 0x01 ? (bkcmd == 1 || bkcmd == 3) : bkcmd >= 2;
+    if (send) {
+        answer(atNs, { code, 0xFF, 0xFF, 0xFF });
+    }
+}
+
+// page 0 is what the display powers up on
+NextionEmulator::page &NextionEmulator::currentPageRef() {
+    if (pages.empty()) {
+        pages.push_back({ 0, "page0", false, {} });
+        current = 0;
+    }
+    return pages[current];
+}
+
+NextionEmulator::page *NextionEmulator::findPage(const std::string &which) {
+    return const_cast<page *>(static_cast<const NextionEmulator *>(this)->findPage(which));
+}
+
+const NextionEmulator::page *NextionEmulator::findPage(const std::string &which) const {
+    int32_t id;
+    bool numeric = parseInteger(which, id);
+    for (const page &p : pages) {
+        if (numeric ? p.id == id : p.name == which) {
+            return &p;
+        }
+    }
+    return nullptr;
+}
+
+bool NextionEmulator::parseInteger(const std::string &text, int32_t &out) {
+    if (text.empty()) {
+        return false;
+    }
+    char *end;
+    long n = strtol(text.c_str(), &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
+    out = n;
+    return true;
+}
@@ -0,0 +1,162 @@
+#ifndef NEXTION_EMULATOR_H
+#define NEXTION_EMULATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+A Nextion display on the host, fed the exact bytes NextionInterface writes to Serial2, so what
+the driver would see and what each display change costs on the wire can be checked without a
+screen. Host only, it allocates freely.
+
+Time is whatever the caller says it is, in microseconds. Bytes written at some time arrive one
+after the other at 10 bits per byte at the current baud, a command runs when its terminator
+arrives (plus processingUs, queued behind the one before it), and answers go back the same
+way. Whatever doesn't fit in the display's input buffer is dropped and answered with 0x24, like
+the real one.
+
+Understood:
+  page <name|id>          switches page, local components go back to their defaults
+  comp.attr=value         value is "text" or an integer, comp may also be page.comp
+  bkcmd=n, baud=n         answering level and link rate, other system variables are accepted
+  sendme                  answers 0x66 <page>
+Anything else is an invalid instruction (0x00). Answers follow bkcmd as on the display: 0 none,
+1 success only, 2 failures only (the power up default), 3 both.
+
+Pages and components can be declared up front with addPage() and addComponent(), then a
+command to an unknown component, or to a txt or val its type doesn't have (by
+NextionTft::typeHasAttribute(), the table tools/nextion_tft.py generates for the firmware),
+gets 0x1A and a string to a number gets 0x1C. A page with no declared components takes
+whatever is sent to it.
+
+Build it with the program using it, e.g.
+  g++ -std=c++17 -Iinclude -Itools/nextion_emulator tools/nextion_emulator/nextion_emulator.cpp yours.cpp
+pio test -e native builds it for test/test_nextion_emulator, which replays a capture through it.
+*/
+class NextionEmulator {
+public:
+    struct value {
+        bool isText;
+        std::string text;
+        int32_t number;
+    };
+
+    struct stats {
+        uint64_t bytes; // received, terminators included
+        uint64_t commands; // executed
+        uint64_t failed; // answered with an error code, answered or not
+        uint64_t overflows; // bytes dropped with a full input buffer
+        uint64_t pageChanges;
+        uint64_t totalLatencyUs; // from the first byte written to the command running
+        uint64_t maxLatencyUs;
+    };
+
+    // per component, keyed by page.component
+    struct componentStats {
+        uint64_t updates;
+        uint64_t bytes;
+        uint64_t lastUpdateUs;
+    };
+
+    explicit NextionEmulator(uint32_t baud = 9600);
+
+    void addPage(uint8_t id, const std::string &name);
+    // type as in the editor: Text, Number, XFloat, Button, Picture, ... Text and Button hold txt
+    void addComponent(const std::string &page, uint8_t id, const std::string &name, const std::string &type);
+
+    // what the MCU wrote at atUs
+    void write(uint64_t atUs, const uint8_t *data, size_t length);
+    // runs everything that has arrived by toUs
+    void advance(uint64_t toUs);
+    // answers that have fully arrived back at the MCU by atUs
+    size_t read(uint64_t atUs, uint8_t *out, size_t max);
+    // 0x65 page component press, as if the driver touched it
+    void touch(uint64_t atUs, uint8_t component, bool pressed);
+
+    const std::string &currentPage() const;
+    uint8_t currentPageId() const;
+    // false if the page, component or attribute was never set or doesn't exist
+    bool get(const std::string &page, const std::string &component, const std::string &attribute, value &out) const;
+    std::string text(const std::string &page, const std::string &component) const;
+
+    uint32_t baud() const;
+    const stats &getStats() const;
+    const std::map<std::string, componentStats> &getComponentStats() const;
+    void resetStats();
+
+    // display side timing, defaults are an ideal display
+    uint32_t processingUs = 0;
+    size_t inputBufferSize = 1024;
+    // baud= above this is refused with 0x11, for a display or a harness that can't go faster
+    uint32_t maxBaud = 921600;
+
+private:
+    struct component {
+        uint8_t id;
+        std::string type;
+        std::map<std::string, value> attributes;
+    };
+
+    struct page {
+        uint8_t id;
+        std::string name;
+        bool declared; // has addComponent()s, unknown names are errors
+        std::map<std::string, component> components;
+    };
+
+    // times below are in nanoseconds, a byte at 921600 baud is under 11us
+    struct wireByte {
+        uint64_t arriveNs;
+        uint64_t writtenNs;
+        uint8_t b;
+    };
+
+    struct pendingCommand {
+        std::vector<uint8_t> bytes;
+        uint64_t writtenNs; // of its first byte
+        uint64_t runNs;
+    };
+
+    uint32_t rate;
+    uint8_t bkcmd = 2;
+
+    std::vector<page> pages;
+    bool pagesDeclared = false; // otherwise pages are made up as they are switched to
+    size_t current = 0;
+
+    std::deque<wireByte> wire;
+    uint64_t wireFreeNs = 0;
+    std::vector<uint8_t> partial;
+    uint64_t partialWrittenNs = 0;
+    uint8_t ffRun = 0;
+    bool corrupt = false; // lost bytes to an overflow, the command is thrown away at its end
+    size_t buffered = 0; // bytes waiting in the input buffer, partial command included
+    std::deque<pendingCommand> queue;
+    uint64_t busyUntilNs = 0;
+
+    std::deque<std::pair<uint64_t, uint8_t>> answers;
+    uint64_t answerFreeNs = 0;
+
+    stats counters = {};
+    std::map<std::string, componentStats> perComponent;
+
+    uint64_t byteNs() const;
+    void receive(const wireByte &w);
+    void runUntil(uint64_t toNs);
+    void execute(const pendingCommand &command);
+    uint8_t assign(const std::string &target, const std::string &text, size_t commandBytes, uint64_t atNs);
+    uint8_t changePage(const std::string &which);
+    void answer(uint64_t atNs, const std::vector<uint8_t> &bytes);
+    void result(uint64_t atNs, uint8_t code);
+
+    page &currentPageRef();
+    page *findPage(const std::string &which);
+    const page *findPage(const std::string &which) const;
+    static bool parseInteger(const std::string &text, int32_t &out);
+};
+
+#endif //NEXTION_EMULATOR_H
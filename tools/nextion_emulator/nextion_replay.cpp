@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "nextion_emulator.h"
+
+/*
+Plays a capture of the Serial2 TX line (raw bytes, as a logic analyser or a USB serial adapter
+on the display pins saves them) into the emulator, back to back at the given baud, and prints
+what every page ends up showing and what it cost.
+
+  g++ -std=c++17 -O2 -Iinclude -Itools/nextion_emulator tools/nextion_emulator/nextion_emulator.cpp \
+      tools/nextion_emulator/nextion_replay.cpp -o nextion_replay
+  ./nextion_replay [--baud 115200] capture.bin
+*/
+int main(int argc, char **argv) {
+    uint32_t baud = 9600;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+            baud = strtoul(argv[++i], nullptr, 10);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--baud n] capture.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    }
+    fclose(f);
+
+    NextionEmulator display(baud);
+    display.write(0, bytes.data(), bytes.size());
+    // long enough for every byte at the slowest rate
+    uint64_t endUs = bytes.size() * 10000000ull / 2400 + 1000000;
+    display.advance(endUs);
+
+    const NextionEmulator::stats &s = display.getStats();
+    uint64_t lastUs = 0;
+    printf("page %s\n", display.currentPage().c_str());
+    for (const auto &entry : display.getComponentStats()) {
+        const NextionEmulator::componentStats &c = entry.second;
+        lastUs = std::max(lastUs, c.lastUpdateUs);
+        size_t dot = entry.first.find('.');
+        std::string text = display.text(entry.first.substr(0, dot), entry.first.substr(dot + 1));
+        printf("  %-32s %6llu updates %8llu bytes  txt \"%s\"\n", entry.first.c_str(),
+            (unsigned long long)c.updates, (unsigned long long)c.bytes, text.c_str());
+    }
+    printf("%llu bytes, %llu commands, %llu failed, %llu overflowed bytes, %llu page changes\n",
+        (unsigned long long)s.bytes, (unsigned long long)s.commands, (unsigned long long)s.failed,
+        (unsigned long long)s.overflows, (unsigned long long)s.pageChanges);
+    if (s.commands > 0) {
+        printf("latency mean %lluus max %lluus, %.1f bytes per command, link ends at %u baud\n",
+            (unsigned long long)(s.totalLatencyUs / s.commands), (unsigned long long)s.maxLatencyUs,
+            (double)s.bytes / s.commands, display.baud());
+    }
+    return 0;
+}
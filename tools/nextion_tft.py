@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""
+Checks the display project against what the firmware sends it and generates include/nextion_tft.h.
+
+The TFT the Nextion Editor compiles starts with a plain header: the model series at 0x02 ("CN2E"
+here), the resolution at 0x0C and again at 0x10, and the file size at 0x3C. Everything past
+that, page and component tables included, is encrypted, so names, ids and types can't be read
+out of it. They come from tools/nextion_manifest.json instead, copied from the editor by
+whoever changes the HMI: for every page its name and the firmware's page enum entry, for every
+component its name and type, and the page and component ids where known (the editor shows
+them, leave null rather than guess).
+
+The generated header has the page names and NextionTft::hasAttribute(), which nextion.cpp
+static_asserts for every widget binding, so a binding to a component that isn't in the
+manifest, or to an attribute its type doesn't have, doesn't build. Ids that are known are
+generated as constants too. Which types have a .txt or a .val goes in as
+NextionTft::typeHasAttribute(), and tools/nextion_emulator answers by that as well.
+
+This runs before every build as a PlatformIO extra script, and by hand:
+  python3 tools/nextion_tft.py [--check]
+--check only verifies the TFT header against the manifest and that the header is up to date.
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+MANIFEST = os.path.join("tools", "nextion_manifest.json")
+OUTPUT = os.path.join("include", "nextion_tft.h")
+
+HEADER_SIZE = 0x40
+TYPES = ("Text", "Number", "XFloat", "Button", "Dual-state button", "Picture", "Crop", "Progress bar",
+         "Gauge", "Slider", "Scrolling text", "Variable", "Timer", "Hotspot", "Waveform", "Checkbox", "Radio")
+# which of them have a .txt, and which a .val, the only place this is written down
+TEXT_TYPES = ("Text", "Button", "Scrolling text", "Dual-state button")
+VALUE_TYPES = ("Number", "XFloat", "Dual-state button", "Progress bar", "Gauge", "Slider", "Checkbox", "Radio")
+
+
+class TftError(Exception):
+    pass
+
+
+def read_header(path):
+    with open(path, "rb") as f:
+        head = f.read(HEADER_SIZE)
+        f.seek(0, os.SEEK_END)
+        size = f.tell()
+    if len(head) < HEADER_SIZE:
+        raise TftError("%s: too short for a TFT header" % path)
+    model = head[0x02:0x06].decode("ascii", "replace")
+    width, height = struct.unpack_from("<HH", head, 0x0C)
+    width2, height2 = struct.unpack_from("<HH", head, 0x10)
+    declared_size, = struct.unpack_from("<I", head, 0x3C)
+    if (width, height) != (width2, height2):
+        raise TftError("%s: resolution %dx%d and %dx%d disagree, not a TFT?" % (path, width, height, width2, height2))
+    if declared_size != size:
+        raise TftError("%s: header says %d bytes, file has %d, truncated?" % (path, declared_size, size))
+    return {"model": model, "width": width, "height": height, "size": size}
+
+
+def load_manifest(path):
+    with open(path) as f:
+        manifest = json.load(f)
+    errors = []
+    enums = set()
+    for page in manifest["pages"]:
+        if page["enum"] in enums:
+            errors.append("page enum %s listed twice" % page["enum"])
+        enums.add(page["enum"])
+        names = set()
+        for component in page["components"]:
+            if component["name"] in names:
+                errors.append("%s.%s listed twice" % (page["name"], component["name"]))
+            names.add(component["name"])
+            if component["type"] not in TYPES:
+                errors.append("%s.%s: unknown type %s" % (page["name"], component["name"], component["type"]))
+    if errors:
+        raise TftError("%s: %s" % (path, "; ".join(errors)))
+    return manifest
+
+
+def check(tft, manifest):
+    if (tft["width"], tft["height"]) != (manifest["width"], manifest["height"]):
+        raise TftError("TFT is %dx%d, the manifest is for %dx%d" % (tft["width"], tft["height"],
+                                                                   manifest["width"], manifest["height"]))
+
+
+def identifier(name):
+    return "".join(c if c.isalnum() else "_" for c in name).upper()
+
+
+def render(tft, manifest):
+    lines = [
+        "// generated by tools/nextion_tft.py from %s and %s, do not edit" % (MANIFEST.replace(os.sep, "/"), manifest["tft"]),
+        "",
+        "#ifndef NEXTION_TFT_H",
+        "#define NEXTION_TFT_H",
+        "",
+        "#include <stdint.h>",
+        "",
+        "class NextionTft {",
+        "public:",
+        '    constexpr static const char MODEL[] = "%s";' % tft["model"],
+        "    constexpr static const uint16_t WIDTH = %d;" % tft["width"],
+        "    constexpr static const uint16_t HEIGHT = %d;" % tft["height"],
+        "    constexpr static const uint32_t FILE_SIZE = %d;" % tft["size"],
+        "",
+    ]
+    for page in manifest["pages"]:
+        lines.append('    constexpr static const char PAGE_%s[] = "%s";' % (page["enum"], page["name"]))
+    ids = []
+    for page in manifest["pages"]:
+        if page["id"] is not None:
+            ids.append("    constexpr static const uint8_t PAGE_%s_ID = %d;" % (page["enum"], page["id"]))
+        for component in page["components"]:
+            if component["id"] is not None:
+                ids.append("    constexpr static const uint8_t %s_%s_ID = %d;" % (page["enum"], identifier(component["name"]), component["id"]))
+    if ids:
+        lines.append("")
+        lines.extend(ids)
+    lines += [
+        "",
+        "    // page is the firmware's page enum entry as a string, e.g. \"DRIVER\", attribute is txt or val",
+        "    constexpr static bool hasAttribute(const char *page, const char *name, const char *attribute) {",
+        "        for (const component &c : components) {",
+        "            if (equal(c.page, page) && equal(c.name, name)) {",
+        "                return typeHasAttribute(c.type, attribute);",
+        "            }",
+        "        }",
+        "        return false;",
+        "    }",
+        "",
+        "    // type as the Nextion editor names it, e.g. \"Dual-state button\", attribute is txt or val",
+        "    constexpr static bool typeHasAttribute(const char *type, const char *attribute) {",
+        "        return equal(attribute, \"txt\") ? listed(TEXT_TYPES, type) : equal(attribute, \"val\") ? listed(VALUE_TYPES, type) : false;",
+        "    }",
+        "",
+        "private:",
+        "    struct component {",
+        "        const char *page;",
+        "        const char *name;",
+        "        const char *type;",
+        "    };",
+        "",
+        "    constexpr static const char *const TEXT_TYPES[] = { %s, nullptr };" % ", ".join('"%s"' % t for t in TEXT_TYPES),
+        "    constexpr static const char *const VALUE_TYPES[] = { %s, nullptr };" % ", ".join('"%s"' % t for t in VALUE_TYPES),
+        "",
+        "    constexpr static const component components[] = {",
+    ]
+    for page in manifest["pages"]:
+        for component in page["components"]:
+            lines.append('        { "%s", "%s", "%s" },' % (page["enum"], component["name"], component["type"]))
+    lines += [
+        "    };",
+        "",
+        "    constexpr static bool listed(const char *const *types, const char *type) {",
+        "        for (; *types != nullptr; types++) {",
+        "            if (equal(*types, type)) {",
+        "                return true;",
+        "            }",
+        "        }",
+        "        return false;",
+        "    }",
+        "",
+        "    constexpr static bool equal(const char *a, const char *b) {",
+        "        while (*a != '\\0' && *a == *b) {",
+        "            a++;",
+        "            b++;",
+        "        }",
+        "        return *a == *b;",
+        "    }",
+        "};",
+        "",
+        "#endif //NEXTION_TFT_H",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def generate(project_dir, check_only=False):
+    manifest = load_manifest(os.path.join(project_dir, MANIFEST))
+    tft = read_header(os.path.join(project_dir, manifest["tft"]))
+    check(tft, manifest)
+    text = render(tft, manifest)
+
+    output = os.path.join(project_dir, OUTPUT)
+    current = None
+    if os.path.exists(output):
+        with open(output) as f:
+            current = f.read()
+    if current == text:
+        return
+    if check_only:
+        raise TftError("%s is out of date, run tools/nextion_tft.py" % OUTPUT)
+    # only written when it changed, so it doesn't rebuild everything every time
+    with open(output, "w") as f:
+        f.write(text)
+    print("nextion_tft: wrote %s" % OUTPUT)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--check", action="store_true", help="verify only, don't write the header")
+    parser.add_argument("--project", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+    args = parser.parse_args(argv)
+    try:
+        generate(os.path.abspath(args.project), args.check)
+    except TftError as e:
+        print("nextion_tft: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+try:
+    # PlatformIO runs extra scripts inside SCons, where Import() exists
+    Import("env")  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main(sys.argv[1:]))
+else:
+    try:
+        generate(env.subst("$PROJECT_DIR"))  # noqa: F821
+    except TftError as e:
+        sys.stderr.write("nextion_tft: %s\n" % e)
+        env.Exit(1)  # noqa: F821